@@ -0,0 +1,23 @@
+#ifndef _LOCK_H
+#define _LOCK_H
+
+/*
+    Recursive lock with an uncontended fast path of one atomic operation.
+    A zero-initialized lock is unlocked and ready to use.
+*/
+struct _lock {
+    volatile int           state; /* 0: unlocked, 1: locked, 2: locked with waiters */
+    volatile unsigned long owner; /* _sys_thread_self of the holder, or 0 */
+    unsigned               depth; /* Number of nested acquisitions by the holder */
+};
+
+extern void _lock_acquire(struct _lock *lock);
+extern int  _lock_try(struct _lock *lock);
+extern void _lock_release(struct _lock *lock);
+
+extern unsigned _atomic_add(volatile unsigned *p, unsigned n);
+extern int _atomic_swap(volatile int *p, int value);
+extern void *_atomic_swapptr(void *volatile *p, void *value);
+extern void *_atomic_casptr(void *volatile *p, void *old, void *value);
+
+#endif /* _LOCK_H */
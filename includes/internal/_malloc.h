@@ -0,0 +1,17 @@
+#ifndef _MALLOC_H
+#define _MALLOC_H
+
+/* size_t is defined in multiple headers */
+#ifndef _HAS_SIZET
+#define _HAS_SIZET
+typedef unsigned size_t;
+#endif
+
+extern void *_malloc_alloc(size_t size);
+extern void *_malloc_aligned(size_t alignment, size_t size);
+extern void *_malloc_realloc(void *p, size_t size);
+extern void *_malloc_realign(void *p, size_t alignment, size_t size);
+extern void  _malloc_free(void *p);
+extern size_t _malloc_size(const void *p);
+
+#endif /* _MALLOC_H */
\ No newline at end of file
@@ -0,0 +1,13 @@
+#ifndef _MEMSCAN_H
+#define _MEMSCAN_H
+
+/* size_t is defined in multiple headers */
+#ifndef _HAS_SIZET
+#define _HAS_SIZET
+typedef unsigned size_t;
+#endif
+
+extern size_t _memscan(const void *s, int c, size_t n);
+extern size_t _memcount(const void *s, int c, size_t n);
+
+#endif /* _MEMSCAN_H */
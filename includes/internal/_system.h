@@ -1,6 +1,8 @@
 #ifndef __SYSTEM_H
 #define __SYSTEM_H
 
+#if defined(_WIN32)
+
 /* Concrete definitions taken from windows.h for low coupling */
 
 #define _SYS_BADHANDLE   ((void*)(long)-1) /* Symbolic wrapper for an invalid handle */
@@ -8,9 +10,42 @@
 #define _SYS_CMDPROC     "cmd.exe"         /* Executable file name of the command processor */
 #define _SYS_CMDPROCARGS " /C "            /* Necessary arguments to the command processor */
 #define _SYS_LOC_MAX     86                /* Maximum locale name length */
+#define _SYS_TEXTMODE    1                 /* Text streams translate '\n' to and from CRLF */
+#define _SYS_MAPALIGN    65536             /* File offsets for _sys_map must be a multiple of this */
+
+#elif defined(__linux__)
+
+/* Concrete definitions for the Linux system call backend (see _system_linux.c) */
+
+#define _SYS_BADHANDLE   ((void*)(long)-1) /* Symbolic wrapper for an invalid file descriptor */
+#define _SYS_CMDPROCVAR  "SHELL"           /* Name of the command processor for system() */
+#define _SYS_CMDPROC     "/bin/sh"         /* Executable file name of the command processor */
+#define _SYS_CMDPROCARGS " -c "            /* Necessary arguments to the command processor */
+#define _SYS_LOC_MAX     86                /* Maximum locale name length */
+#define _SYS_TEXTMODE    0                 /* Text and binary streams are identical */
+#define _SYS_MAPALIGN    4096              /* File offsets for _sys_map must be a multiple of this */
+
+#else
+#error "Unsupported target system"
+#endif
 
 typedef void *_sys_handle_t; /* Symbolic wrapper for the system's handle type */
 
+/* One block of a vectored transfer (laid out like the system's own iovec) */
+struct _sys_iovec {
+    void    *base; /* Start of the block */
+    unsigned len;  /* Length of the block in bytes */
+};
+
+/* One read or write for _sys_iobatch, done at the file's current position */
+struct _sys_ioreq {
+    _sys_handle_t fd;     /* File to transfer with */
+    int           write;  /* Nonzero to write buf rather than read into it */
+    void         *buf;    /* Data to write, or room to read into */
+    unsigned      len;    /* Length of buf in bytes */
+    int           result; /* Bytes transferred or -1, set on completion */
+};
+
 /* wchar_t is defined in multiple headers */
 #ifndef _HAS_WCHART
 #define _HAS_WCHART
@@ -30,12 +65,26 @@ extern char *_sys_commandline(void);
 
 extern void _sys_exit(int status);
 
+extern unsigned long _sys_thread_self(void);
+extern void *_sys_thread_data(void);
+extern void  _sys_thread_setdata(void *data);
+extern void  _sys_thread_atexit(void (*fn)(void));
+extern _sys_handle_t _sys_thread_create(void (*fn)(void *arg), void *arg);
+extern void _sys_thread_join(_sys_handle_t thread);
+extern void _sys_wait(volatile int *addr, int value);
+extern void _sys_wake(volatile int *addr, int n);
+extern void _sys_yield(void);
+
 extern char *_sys_getenv(const char *name);
 extern int _sys_system(const char *cmd_proc, char *cmd_line);
 
 extern void *_sys_alloc(unsigned bytes);
 extern void  _sys_free(void *p);
 
+extern void *_sys_pagealloc(unsigned bytes, unsigned align);
+extern void *_sys_pageremap(void *p, unsigned old, unsigned bytes);
+extern void  _sys_pagefree(void *p, unsigned bytes);
+
 extern _sys_handle_t _sys_heapcreate();
 extern void _sys_heapdestroy(_sys_handle_t *heap);
 extern void *_sys_heapalloc(_sys_handle_t heap, unsigned bytes);
@@ -50,10 +99,21 @@ extern _sys_handle_t _sys_openfile(const char *filename, int orient, int attr, i
 extern int _sys_closefile(_sys_handle_t fd);
 
 extern int _sys_read(_sys_handle_t fd, void *p, int n);
+extern int _sys_readv(_sys_handle_t fd, struct _sys_iovec *iov, int n);
 extern int _sys_write(_sys_handle_t fd, void *p, int n);
+extern int _sys_writev(_sys_handle_t fd, struct _sys_iovec *iov, int n);
+extern int _sys_pread(_sys_handle_t fd, void *p, int n, long long offset);
+extern int _sys_pwrite(_sys_handle_t fd, void *p, int n, long long offset);
+extern int _sys_copy(_sys_handle_t dst, _sys_handle_t src, int n);
+extern int _sys_iobatch(struct _sys_ioreq *req, int n);
 
 extern int _sys_tell(_sys_handle_t fd, long long *pos);
 extern int _sys_seek(_sys_handle_t fd, long long offset, int whence);
+extern int _sys_filesize(_sys_handle_t fd, long long *size);
+extern unsigned _sys_blksize(_sys_handle_t fd);
+
+extern void *_sys_map(_sys_handle_t fd, long long offset, unsigned bytes);
+extern void  _sys_unmap(void *p, unsigned bytes);
 
 extern int _sys_unlink(const char *filename);
 extern int _sys_move(const char *old_name, const char *new_name);
@@ -61,4 +121,9 @@ extern int _sys_move(const char *old_name, const char *new_name);
 extern int _sys_mbtowc(wchar_t *wc, const char *s, int n);
 extern int _sys_wctomb(char *s, const wchar_t *wc, int n);
 
+#if defined(__linux__)
+/* Raw system call for the Linux halves of _systime.c and _sysconio.c */
+extern long _sys_linux_call(long n, long a, long b, long c, long d, long e, long f);
+#endif
+
 #endif /* __SYSTEM_H */
@@ -1,9 +1,9 @@
 #ifndef _STDIO_H
 #define _STDIO_H
 
+#include "_lock.h"
 #include "_stdc11.h"
 #include "_system.h"
-#include "_deque.h"
 
 /* size_t is defined in multiple headers */
 #ifndef _HAS_SIZET
@@ -22,11 +22,26 @@ typedef char *va_list;
 #define NULL 0
 #endif
 
+/* Signed counterpart of size_t for getline and getdelim */
+#ifndef _HAS_SSIZET
+#define _HAS_SSIZET
+typedef int ssize_t;
+#endif
+
 typedef long long fpos_t;
 
+struct _log;    /* Shared state of a log stream (see setvbuf with _IOLOG) */
+struct _async;  /* Background transfer state (see setvbuf with _IOASYNC) */
+struct _pcache; /* Window of the file kept for positional reads (see _fpread) */
+struct _mem;    /* Memory behind a memory stream (see fmemopen and open_memstream) */
+struct _cookie; /* Callbacks behind a custom stream (see _fopencookie) */
+
 #define _UNGETSIZ    64
+#define _MINBUFSIZ   2 /* Room for a newline expanded to CRLF */
+#define _MAPSIZ      0x1000000 /* Mapping window for mapped streams */
+#define _BUFMAX      0x400000  /* Largest size a growing stream buffer reaches */
 
-#define BUFSIZ       512
+#define BUFSIZ       4096
 #define EOF          (-1)
 
 /* Based on Windows XP limits */
@@ -68,33 +83,74 @@ typedef size_t rsize_t;
 #define _OPEN   0x0200 /* Handle points to an open "file" */
 #define _PEEK   0x0400 /* Buffer has a peeked character */
 #define _TEMP   0x0800 /* File is to be deleted on closing */
-#define _ALLOC  0x1000 /* Unget buffer was dynamically allocated */
+#define _MAP    0x1000 /* Buffer is a window onto a read-only file mapping */
+#define _GROW   0x2000 /* Buffer grows while it's filled or flushed whole */
+#define _LOG    0x4000 /* Buffer is a ring of segments filled without locking */
+#define _ASYNC  0x8000 /* Buffer is doubled, with the other half in transfer in the background */
+#define _POS    0x10000 /* The system file position is tracked in pos */
+#define _MEM    0x20000 /* Stream reads and writes memory instead of a file */
+#define _COOKIE 0x40000 /* Stream reads and writes through caller callbacks instead of a file */
 
 #define _IOFBF 0    /* Fully buffered */
 #define _IOLBF _LBF /* Line buffered */
 #define _IONBF _NBF /* Unbuffered */
+#define _IOLOG _LOG /* Whole records from many threads, written in batches (extension) */
+#define _IOASYNC _ASYNC /* Fully buffered with read-ahead and write-behind (extension) */
 
 #define SEEK_SET 0
 #define SEEK_CUR 1
 #define SEEK_END 2
 
 struct _buffer {
-  _sys_handle_t fd;    /* Character source for the buffer */
-  struct _deque buf;   /* Queue of buffered characters */
-  struct _deque unget; /* Stack of pushed back characters */
-  char          peek;  /* Next unread but not yet buffered character */
-  unsigned      flag;  /* State of the buffer */
-  char         *tmp;   /* The name of the file (if it's temporary) */
+  _sys_handle_t fd;                /* Character source for the buffer */
+  char         *base;              /* Start of the buffer */
+  char         *begin;             /* First unread (or unflushed) buffered character */
+  char         *end;               /* One past the last buffered character */
+  size_t        size;              /* Capacity of the buffer */
+  char          unget[_UNGETSIZ];  /* Stack of pushed back characters */
+  size_t        nunget;            /* Number of pushed back characters */
+  char          peek;              /* Next unread but not yet buffered character */
+  fpos_t        pos;               /* System file position (if _POS) */
+  char         *mark;              /* Buffered characters before mark have been counted */
+  size_t        lines;             /* Newlines buffered past mark (text input, if mark is set) */
+  unsigned      flag;              /* State of the buffer */
+  char         *tmp;               /* The name of the file (if it's temporary) */
+  struct _buffer *prev;            /* Previous stream in the open stream list */
+  struct _buffer *next;            /* Next stream in the open (or free) stream list */
+  struct _lock  lock;              /* Serializes access from multiple threads */
+  struct _log  *log;               /* Segment ring of a log stream (if _LOG) */
+  struct _async *async;            /* Second buffer and worker thread (if _ASYNC) */
+  struct _pcache *pcache;          /* Positional read cache, made on first use */
+  struct _mem   *mem;              /* Memory in place of the file (if _MEM) */
+  struct _cookie *cookie;          /* Callbacks in place of the file (if _COOKIE) */
 };
 
 typedef struct _buffer FILE;
 
+/*
+    Callbacks of a custom stream (see _fopencookie). read and write return
+    the number of characters transferred, 0 at end-of-file, or -1 on error.
+    seek stores the new position in *offset and returns 0 on success.
+    close returns 0 on success.
+*/
+typedef ssize_t (*_cookie_read_t)(void *cookie, char *buf, size_t size);
+typedef ssize_t (*_cookie_write_t)(void *cookie, const char *buf, size_t size);
+typedef int (*_cookie_seek_t)(void *cookie, fpos_t *offset, int whence);
+typedef int (*_cookie_close_t)(void *cookie);
+
+typedef struct {
+  _cookie_read_t  read;  /* Null for streams that are always at end-of-file */
+  _cookie_write_t write; /* Null to discard all output */
+  _cookie_seek_t  seek;  /* Null for streams that can't seek */
+  _cookie_close_t close; /* Null if there's nothing to release */
+} _cookie_io_t;
+
 extern FILE __io_buf[];
 extern FILE __io_tmp[];
+extern FILE *__io_open;
 
 extern char __tmp_name[];
 extern char __stdin_buf[];
-extern char __stdin_unget[];
 extern char __stdout_buf[];
 extern char __stderr_buf[];
 
@@ -107,6 +163,19 @@ extern char __stderr_buf[];
 #define getchar()   (getc(stdin))
 #define putchar(c)  (putc(c, stdout))
 
+/*
+    The unlocked variants work straight on the buffer when they can. The
+    caller is responsible for holding the lock (see flockfile).
+*/
+#define getc_unlocked(in) \
+    (((in)->flag & _READ && !(in)->nunget && (in)->begin != (in)->end) ? \
+        (int)(unsigned char)*(in)->begin++ : fgetc_unlocked(in))
+#define putc_unlocked(c,out) \
+    (((out)->flag & _WRITE && !((out)->flag & (_LBF | _NBF | _TEXT | _LOG)) && (out)->end != (out)->base + (out)->size) ? \
+        (int)(unsigned char)(*(out)->end++ = (char)(c)) : fputc_unlocked(c, out))
+#define getchar_unlocked()  (getc_unlocked(stdin))
+#define putchar_unlocked(c) (putc_unlocked(c, stdout))
+
 extern int remove(const char *filename);
 extern int rename(const char *old_name, const char *new_name);
 
@@ -194,4 +263,33 @@ extern int vsscanf_s(const char * restrict s, const char * restrict fmt, va_list
 #endif /* __STD_LIB_EXT1__ */
 #endif /* __STD_WANT_LIB_EXT1__ */
 
+extern void flockfile(FILE *stream);
+extern int ftrylockfile(FILE *stream);
+extern void funlockfile(FILE *stream);
+
+extern int fgetc_unlocked(FILE *in);
+extern int fputc_unlocked(int c, FILE *out);
+extern size_t fread_unlocked(void * restrict p, size_t size, size_t n, FILE * restrict in);
+extern size_t fwrite_unlocked(const void * restrict p, size_t size, size_t n, FILE * restrict out);
+
+extern ssize_t getdelim(char ** restrict line, size_t * restrict n, int delim, FILE * restrict in);
+extern ssize_t getline(char ** restrict line, size_t * restrict n, FILE * restrict in);
+
+extern FILE *fmemopen(void * restrict buf, size_t size, const char * restrict mode);
+extern FILE *open_memstream(char **ptr, size_t *sizeloc);
+
+extern size_t _freadv(FILE * restrict in, const struct _sys_iovec *iov, int n);
+extern size_t _fwritev(FILE * restrict out, const struct _sys_iovec *iov, int n);
+extern int _ffill(FILE *streams[], int n);
+
+extern size_t _fpread(void * restrict p, size_t size, size_t n, fpos_t offset, FILE * restrict in);
+extern size_t _fpwrite(const void * restrict p, size_t size, size_t n, fpos_t offset, FILE * restrict out);
+
+extern size_t _fcopy(FILE * restrict dst, FILE * restrict src, size_t n);
+
+extern FILE *_fopencookie(void * restrict cookie, const char * restrict mode, _cookie_io_t io);
+
+extern size_t _setbufsiz(size_t size);
+extern size_t _settmpspill(size_t size);
+
 #endif /* _STDIO_H */
@@ -31,6 +31,8 @@ typedef struct _div_t   { int       quot, rem; } div_t;
 typedef struct _ldiv_t  { long      quot, rem; } ldiv_t;
 typedef struct _lldiv_t { long long quot, rem; } lldiv_t;
 
+struct _arena; /* Region allocator, see _arena_create */
+
 typedef int (*_cmp_func_t)(const void*, const void*);
 typedef void (*_exitfunc_t)(void);
 
@@ -64,6 +66,8 @@ extern void *malloc(size_t size);
 extern void *calloc(size_t n, size_t size);
 extern void *realloc(void *p, size_t size);
 extern void free(void *p);
+extern int posix_memalign(void **p, size_t alignment, size_t size);
+extern void *_aligned_realloc(void *p, size_t size, size_t alignment);
 
 extern void *bsearch(const void *key, const void *base, size_t n, size_t size, _cmp_func_t cmp);
 extern void qsort(void *base, size_t n, size_t size, _cmp_func_t cmp);
@@ -90,4 +94,9 @@ extern size_t wcstombs(char * restrict s, const wchar_t * restrict ws, size_t n)
 extern char *_ecvt(double arg, int ndigits, int *decpt, int *sign);
 extern char *_fcvt(double arg, int ndigits, int *decpt, int *sign);
 
+extern struct _arena *_arena_create(size_t chunk_size);
+extern void *_arena_alloc(struct _arena *arena, size_t size);
+extern void _arena_reset(struct _arena *arena);
+extern void _arena_destroy(struct _arena *arena);
+
 #endif /* _STDLIB_H */
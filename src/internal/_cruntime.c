@@ -1,4 +1,3 @@
-#include "_deque.h"
 #include "_system.h"
 #include "_time.h"
 #include "locale.h"
@@ -54,25 +53,30 @@ int _main_init()
 void init_stdio()
 {
     __io_buf[0].fd = __sys_stdin = _sys_stdin();
-    _deque_init(__io_buf[0].buf, __stdin_buf, BUFSIZ);
-    _deque_init(__io_buf[0].unget, __stdin_unget, _UNGETSIZ);
-    __io_buf[0].flag = _LBF | _READ | _TEXT | _OPEN;
+    __io_buf[0].flag = _READ | (_SYS_TEXTMODE ? _TEXT : 0) | _OPEN;
+    setvbuf(&__io_buf[0], __stdin_buf, _IOLBF, BUFSIZ);
 
     __io_buf[1].fd = __sys_stdout = _sys_stdout();
-    _deque_init(__io_buf[1].buf, __stdout_buf, BUFSIZ);
-    __io_buf[1].flag = _LBF | _WRITE | _TEXT | _OPEN;
+    __io_buf[1].flag = _WRITE | (_SYS_TEXTMODE ? _TEXT : 0) | _OPEN;
+    setvbuf(&__io_buf[1], __stdout_buf, _IOLBF, BUFSIZ);
 
     __io_buf[2].fd = __sys_stderr = _sys_stderr();
-    _deque_init(__io_buf[2].buf, __stdin_buf, BUFSIZ);
-    __io_buf[2].flag = _NBF | _WRITE | _TEXT | _OPEN;
+    __io_buf[2].flag = _WRITE | (_SYS_TEXTMODE ? _TEXT : 0) | _OPEN;
+    setvbuf(&__io_buf[2], __stderr_buf, _IONBF, _MINBUFSIZ);
+
+    /* The standard streams start out as the only open streams */
+    __io_open = &__io_buf[0];
+    __io_buf[0].next = &__io_buf[1];
+    __io_buf[1].prev = &__io_buf[0];
+    __io_buf[1].next = &__io_buf[2];
+    __io_buf[2].prev = &__io_buf[1];
 }
 
 void finalize_stdio()
 {
-    int i;
-
-    for (i = 0; i < FOPEN_MAX; ++i)
-        fclose(&__io_buf[i]);
+    /* fclose unlinks the stream, so this walks down the list */
+    while (__io_open)
+        fclose(__io_open);
 }
 
 void set_defaults()
@@ -93,7 +97,8 @@ static void parse_cmdline(const char *s)
     /* Always allocate at least one spot for the trailing null pointer */
     sys_argv = (char**)_sys_alloc(sizeof *sys_argv);
 
-    while (*s) {
+    /* Keep going past the end of the line until the last argument is finalized */
+    while (*s || n > 0) {
         if (_CMDLINE_QUOTE(*s)) {
             /* Restart the counter and copy everything up to the next unescaped quote */
             for (n = 0; *++s && !_CMDLINE_QUOTE(*s); ++n)
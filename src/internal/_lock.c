@@ -0,0 +1,158 @@
+#include "_lock.h"
+#include "_system.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define _cas(p, old, val) _InterlockedCompareExchange((volatile long*)(p), (val), (old))
+#define _xchg(p, val)     _InterlockedExchange((volatile long*)(p), (val))
+#define _dec(p)           _InterlockedDecrement((volatile long*)(p))
+#define _xadd(p, n)       _InterlockedExchangeAdd((volatile long*)(p), (n))
+#else
+#define _cas(p, old, val) __sync_val_compare_and_swap((p), (old), (val))
+#define _xchg(p, val)     __sync_lock_test_and_set((p), (val))
+#define _dec(p)           __sync_sub_and_fetch((p), 1)
+#define _xadd(p, n)       __sync_fetch_and_add((p), (n))
+#endif
+
+/* 
+    ===================================================
+                Static helper declarations
+    ===================================================
+*/
+
+static void acquire_state(struct _lock *lock);
+static void release_state(struct _lock *lock);
+
+/* 
+    ===================================================
+                Internal function definitions
+    ===================================================
+*/
+
+/*
+    @description:
+        Acquires the lock for the calling thread, blocking until it's available.
+*/
+void _lock_acquire(struct _lock *lock)
+{
+    unsigned long self = _sys_thread_self();
+
+    /* Only the holder can ever see itself as the owner */
+    if (lock->owner == self)
+        ++lock->depth;
+    else {
+        acquire_state(lock);
+        lock->owner = self;
+        lock->depth = 1;
+    }
+}
+
+/*
+    @description:
+        Acquires the lock for the calling thread only if that's possible
+        without blocking. Returns nonzero on success.
+*/
+int _lock_try(struct _lock *lock)
+{
+    unsigned long self = _sys_thread_self();
+
+    if (lock->owner == self)
+        ++lock->depth;
+    else if (_cas(&lock->state, 0, 1) == 0) {
+        lock->owner = self;
+        lock->depth = 1;
+    }
+    else {
+        return 0;
+    }
+
+    return 1;
+}
+
+/*
+    @description:
+        Releases one acquisition of the lock by the calling thread.
+*/
+void _lock_release(struct _lock *lock)
+{
+    if (--lock->depth == 0) {
+        lock->owner = 0;
+        release_state(lock);
+    }
+}
+
+/*
+    @description:
+        Atomically adds n to the value at p and returns the value before the add.
+*/
+unsigned _atomic_add(volatile unsigned *p, unsigned n)
+{
+    return (unsigned)_xadd(p, n);
+}
+
+/*
+    @description:
+        Atomically stores value at p and returns the value it replaced.
+        Also a full memory barrier, so it can publish preceding writes.
+*/
+int _atomic_swap(volatile int *p, int value)
+{
+    return _xchg(p, value);
+}
+
+/*
+    @description:
+        Pointer version of _atomic_swap.
+*/
+void *_atomic_swapptr(void *volatile *p, void *value)
+{
+    return (void*)_xchg((volatile long*)p, (long)value);
+}
+
+/*
+    @description:
+        Atomically stores value at p if p still holds old. Returns the value
+        that was at p, which equals old exactly when the store happened.
+*/
+void *_atomic_casptr(void *volatile *p, void *old, void *value)
+{
+    return (void*)_cas((volatile long*)p, (long)old, (long)value);
+}
+
+/* 
+    ===================================================
+                Static helper definitions
+    ===================================================
+*/
+
+/*
+    @description:
+        Takes the lock state word, sleeping in the system while it's contended.
+*/
+void acquire_state(struct _lock *lock)
+{
+    int state = _cas(&lock->state, 0, 1);
+
+    if (state != 0) {
+        /* Announce a waiter so the holder knows to wake someone on release */
+        if (state != 2)
+            state = _xchg(&lock->state, 2);
+
+        while (state != 0) {
+            _sys_wait(&lock->state, 2);
+            state = _xchg(&lock->state, 2);
+        }
+    }
+}
+
+/*
+    @description:
+        Gives up the lock state word, waking a waiter if there might be one.
+*/
+void release_state(struct _lock *lock)
+{
+    if (_dec(&lock->state) != 0) {
+        lock->state = 0;
+        _sys_wake(&lock->state, 1);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,561 @@
+#include "_lock.h"
+#include "_malloc.h"
+#include "_system.h"
+#include "stdint.h"
+#include "string.h"
+
+/*
+    Small blocks are carved from 64K slabs, each holding blocks of a single
+    size class, and recycled through intrusive free lists. A slab is aligned
+    to its own size, so a block's class is found by looking up the slab its
+    address falls in, and small blocks carry no header at all. Anything
+    bigger than the largest class gets pages of its own, with a header in
+    front of it.
+
+    realloc keeps a block where it is when it can: a small block until it
+    outgrows its class or shrinks to half of it, a large block while it fits
+    its mapping and uses more than half of it. A large block that grows is
+    remapped by the system, not copied, and with headroom, so one grown a
+    bit at a time isn't remapped every time. Shrinking hands pages back.
+
+    Aligned requests need no padding: a slab aligned to its size holds blocks
+    aligned to every power of two their size is a multiple of, so a small
+    aligned block just comes from the first class with a suitable size. A
+    large block starts at a cache line or, for stricter alignment, the
+    alignment itself, its mapping being aligned to at least the same.
+
+    Each thread caches a bounded list of free blocks per class, so most
+    malloc/free pairs touch no shared state. A cache that overflows hands
+    half its list back to the class's lock-free stack of freed chains, which
+    is where blocks freed on one thread make their way to the others.
+*/
+#define _SLABSHIFT 16
+#define _SLABSIZE  (1UL << _SLABSHIFT)
+#define _SLABCOUNT ((UINTPTR_MAX >> _SLABSHIFT) + 1) /* Slabs that fit the address space */
+#define _GRAIN     16                                /* Block size granularity and minimum alignment */
+#define _CLASSMAX  16384                             /* Largest size served from a slab */
+#define _LARGEMAX  ((size_t)-1 / 2)                  /* Largest size served at all */
+#define _LINESIZE  64                                /* Least alignment of a large block */
+#define _NCLASSES  36                                /* 8 linear classes, then 4 per power of two */
+#define _CACHEBYTES 32768                            /* Bytes a thread may cache per class... */
+#define _CACHEMIN   2                                /* ...but at least this many blocks */
+#define _CACHEMAX   128                              /* ...and at most this many */
+
+/* Overlays the first block of a chain of free blocks handed back to a size class */
+struct chain {
+    void         *next;  /* Next block of this chain, like any free block */
+    struct chain *older; /* Chain pushed before this one */
+    unsigned      count; /* Blocks in this chain */
+};
+
+/* Shared state for one size class */
+struct size_class {
+    void *volatile freed; /* Stack of chains, pushed without the lock */
+    struct _lock   lock;  /* Serializes taking from freed and guards the fields below */
+    char          *bump;  /* First never used block in the newest slab */
+    char          *end;   /* End of the newest slab */
+};
+
+/* One thread's free blocks of a size class */
+struct bin {
+    void    *head;  /* Free blocks, each holding a pointer to the next */
+    unsigned count; /* Blocks in the list */
+    unsigned limit; /* Past this many, half the list goes back to the class */
+};
+
+/* Thread cache, found through _sys_thread_data */
+struct thread_cache {
+    struct bin bins[_NCLASSES];
+};
+
+/* Sits right before a large block */
+struct large {
+    size_t size;   /* Usable bytes from the payload on */
+    size_t length; /* Bytes mapped, starting offset bytes before the payload */
+    size_t offset; /* Alignment of the payload and its distance from the mapping */
+    size_t pad;    /* Keeps the payload 16 byte aligned */
+};
+
+static struct size_class classes[_NCLASSES];
+
+/* Size class + 1 of the slab at each slab-aligned address, or 0 if it's not a slab */
+static volatile unsigned char slab_class[_SLABCOUNT];
+
+/* 
+    ===================================================
+                Static helper declarations
+    ===================================================
+*/
+
+static unsigned class_index(size_t size);
+static size_t class_size(unsigned index);
+static int stays_small(size_t old, size_t size);
+static void *large_resize(void *p, size_t size);
+static struct thread_cache *thread_cache(void);
+static void cache_release(void);
+static void *cache_alloc(unsigned index);
+static void cache_free(unsigned index, void *p);
+static void *class_take(unsigned index, unsigned n, unsigned *count);
+static void class_give(unsigned index, void *p, unsigned count);
+static void *large_alloc(size_t size, size_t alignment);
+static struct large *large_header(const void *p);
+
+/* 
+    ===================================================
+                Internal function definitions
+    ===================================================
+*/
+
+/*
+    @description:
+        Allocates a block of at least size bytes, or returns NULL.
+*/
+void *_malloc_alloc(size_t size)
+{
+    if (size <= _CLASSMAX)
+        return cache_alloc(class_index(size));
+
+    return large_alloc(size, _LINESIZE);
+}
+
+/*
+    @description:
+        Allocates a block of at least size bytes starting at a multiple
+        of alignment, which must be a power of two. Returns NULL on failure.
+*/
+void *_malloc_aligned(size_t alignment, size_t size)
+{
+    unsigned index;
+
+    if (alignment <= _GRAIN)
+        return _malloc_alloc(size);
+
+    /* There's always a power of two class to fall back on */
+    if (size <= _CLASSMAX && alignment <= _CLASSMAX) {
+        for (index = class_index(size); class_size(index) % alignment != 0; ++index)
+            ;
+
+        return cache_alloc(index);
+    }
+
+    return large_alloc(size, alignment < _LINESIZE ? _LINESIZE : alignment);
+}
+
+/*
+    @description:
+        Resizes the block at p to at least size bytes, moving it if necessary.
+        Returns NULL and leaves the block untouched on failure.
+*/
+void *_malloc_realloc(void *p, size_t size)
+{
+    size_t old = _malloc_size(p);
+    void *mem;
+
+    if (old > _CLASSMAX && size > _CLASSMAX) {
+        if ((mem = large_resize(p, size)) != NULL)
+            return mem;
+
+        /* Otherwise copy, keeping the block's alignment */
+        if (!(mem = large_alloc(size, large_header(p)->offset)))
+            return NULL;
+
+        memcpy(mem, p, old < size ? old : size);
+        _malloc_free(p);
+
+        return mem;
+    }
+    else if (old <= _CLASSMAX && stays_small(old, size))
+        return p;
+
+    if (!(mem = _malloc_alloc(size)))
+        return NULL;
+
+    memcpy(mem, p, old < size ? old : size);
+    _malloc_free(p);
+
+    return mem;
+}
+
+/*
+    @description:
+        Resizes the block at p like _malloc_realloc, but if it has to move,
+        the new block starts at a multiple of alignment, a power of two.
+*/
+void *_malloc_realign(void *p, size_t alignment, size_t size)
+{
+    size_t old = _malloc_size(p);
+    void *mem;
+
+    /* Resizing in place, or remapping a large block at least as aligned, keeps the alignment */
+    if ((uintptr_t)p % alignment == 0) {
+        if (old > _CLASSMAX ? size > _CLASSMAX && large_header(p)->offset >= alignment : stays_small(old, size))
+            return _malloc_realloc(p, size);
+    }
+
+    if (!(mem = _malloc_aligned(alignment, size)))
+        return NULL;
+
+    memcpy(mem, p, old < size ? old : size);
+    _malloc_free(p);
+
+    return mem;
+}
+
+/*
+    @description:
+        Releases a block from _malloc_alloc, _malloc_aligned, or _malloc_realloc.
+        Do nothing if p is NULL.
+*/
+void _malloc_free(void *p)
+{
+    unsigned index;
+
+    if (!p)
+        return;
+
+    if ((index = slab_class[(uintptr_t)p >> _SLABSHIFT]) != 0)
+        cache_free(index - 1, p);
+    else {
+        struct large *header = large_header(p);
+
+        _sys_pagefree((char*)p - header->offset, header->length);
+    }
+}
+
+/*
+    @description:
+        Returns the number of usable bytes in the block at p.
+*/
+size_t _malloc_size(const void *p)
+{
+    unsigned index = slab_class[(uintptr_t)p >> _SLABSHIFT];
+
+    return index ? class_size(index - 1) : large_header(p)->size;
+}
+
+/* 
+    ===================================================
+                Static helper definitions
+    ===================================================
+*/
+
+/*
+    @description:
+        Finds the smallest size class that fits size bytes. Classes go up by
+        16 bytes to 128, then by a quarter of the power of two below them.
+*/
+unsigned class_index(size_t size)
+{
+    unsigned bits = 7;
+
+    if (size <= 128)
+        return size ? (unsigned)(size - 1) / _GRAIN : 0;
+
+    while ((size - 1) >> (bits + 1))
+        ++bits;
+
+    return 8 + (bits - 7) * 4 + (unsigned)((size - 1) >> (bits - 2)) - 4;
+}
+
+/*
+    @description:
+        Returns the block size of a size class.
+*/
+size_t class_size(unsigned index)
+{
+    unsigned group;
+
+    if (index < 8)
+        return (index + 1) * _GRAIN;
+
+    group = (index - 8) / 4;
+
+    return ((size_t)128 << group) + ((index - 8) % 4 + 1) * ((size_t)32 << group);
+}
+
+/*
+    @description:
+        Tells whether a small block of old usable bytes should stay
+        where it is when resized to size bytes.
+*/
+int stays_small(size_t old, size_t size)
+{
+    return size <= old && class_size(class_index(size)) > old / 2;
+}
+
+/*
+    @description:
+        Resizes a large block without copying it: in place if it fits the
+        mapping, or else by having the system resize or move the mapping.
+        Returns NULL, with the block untouched, if that's not possible.
+*/
+void *large_resize(void *p, size_t size)
+{
+    struct large *header = large_header(p);
+    size_t offset = header->offset;
+    size_t room = header->length - offset;
+    size_t want = size;
+    char *map;
+
+    if (size <= room && size > room / 2) {
+        header->size = size;
+        return p;
+    }
+
+    /* A moved mapping is only as aligned as the system's mapping granularity */
+    if (offset > _SYS_MAPALIGN || size > _LARGEMAX)
+        return NULL;
+
+    /* Growth asks for the room plus half again, and settles for the exact size if that fails */
+    if (size > room && room / 2 <= _LARGEMAX - room && room + room / 2 > size)
+        want = room + room / 2;
+
+    map = (char*)_sys_pageremap((char*)p - offset, header->length, offset + want);
+
+    if (!map && want != size) {
+        want = size;
+        map = (char*)_sys_pageremap((char*)p - offset, header->length, offset + want);
+    }
+
+    if (!map)
+        return NULL;
+
+    header = (struct large*)(map + offset) - 1;
+    header->size = size;
+    header->length = offset + want;
+
+    return header + 1;
+}
+
+/*
+    @description:
+        Returns the calling thread's cache, creating it on first use.
+        Returns NULL if there isn't memory for one.
+*/
+struct thread_cache *thread_cache(void)
+{
+    struct thread_cache *cache = (struct thread_cache*)_sys_thread_data();
+    unsigned index, count, i;
+
+    if (!cache) {
+        /* The cache itself has to come straight from its size class */
+        index = class_index(sizeof *cache);
+
+        if (!(cache = (struct thread_cache*)class_take(index, 1, &count)))
+            return NULL;
+
+        /* A recycled chain may bring more than the one block we need */
+        if (count > 1)
+            class_give(index, *(void**)cache, count - 1);
+
+        for (i = 0; i < _NCLASSES; ++i) {
+            size_t limit = _CACHEBYTES / class_size(i);
+
+            cache->bins[i].head = NULL;
+            cache->bins[i].count = 0;
+            cache->bins[i].limit = limit < _CACHEMIN ? _CACHEMIN : limit > _CACHEMAX ? _CACHEMAX : (unsigned)limit;
+        }
+
+        _sys_thread_setdata(cache);
+        _sys_thread_atexit(cache_release);
+    }
+
+    return cache;
+}
+
+/*
+    @description:
+        Hands the calling thread's cached blocks back to their size classes
+        and releases the cache itself. Runs as a created thread ends.
+*/
+void cache_release(void)
+{
+    struct thread_cache *cache = (struct thread_cache*)_sys_thread_data();
+    unsigned i;
+
+    if (!cache)
+        return;
+
+    _sys_thread_setdata(NULL);
+
+    /* A bin's list already ends in NULL, so it goes back as one chain */
+    for (i = 0; i < _NCLASSES; ++i) {
+        if (cache->bins[i].count > 0)
+            class_give(i, cache->bins[i].head, cache->bins[i].count);
+    }
+
+    *(void**)cache = NULL;
+    class_give(class_index(sizeof *cache), cache, 1);
+}
+
+/*
+    @description:
+        Takes a block of a size class from the thread cache,
+        refilling the cache from the class when it's empty.
+*/
+void *cache_alloc(unsigned index)
+{
+    struct thread_cache *cache = thread_cache();
+    struct bin *bin;
+    unsigned count;
+    void *p;
+
+    if (!cache) {
+        if ((p = class_take(index, 1, &count)) != NULL && count > 1)
+            class_give(index, *(void**)p, count - 1);
+
+        return p;
+    }
+
+    bin = &cache->bins[index];
+
+    if (!bin->head && !(bin->head = class_take(index, bin->limit / 2, &bin->count)))
+        return NULL;
+
+    p = bin->head;
+    bin->head = *(void**)p;
+    --bin->count;
+
+    return p;
+}
+
+/*
+    @description:
+        Puts a block of a size class in the thread cache, handing
+        half the cache back to the class when it's full.
+*/
+void cache_free(unsigned index, void *p)
+{
+    struct thread_cache *cache = thread_cache();
+    struct bin *bin;
+    unsigned n, i;
+    void *last;
+
+    if (!cache) {
+        *(void**)p = NULL;
+        class_give(index, p, 1);
+        return;
+    }
+
+    bin = &cache->bins[index];
+    *(void**)p = bin->head;
+    bin->head = p;
+
+    if (++bin->count > bin->limit) {
+        n = bin->count / 2;
+
+        /* The newest blocks stay, they're the most likely to still be in the processor's cache */
+        for (last = bin->head, i = 1; i < bin->count - n; ++i)
+            last = *(void**)last;
+
+        p = *(void**)last;
+        *(void**)last = NULL;
+        bin->count -= n;
+        class_give(index, p, n);
+    }
+}
+
+/*
+    @description:
+        Takes a chain of free blocks from a size class: the most recently
+        given back chain if there is one, or else n new blocks. Stores the
+        length of the chain in count and returns NULL if there's no memory.
+*/
+void *class_take(unsigned index, unsigned n, unsigned *count)
+{
+    struct size_class *sc = &classes[index];
+    size_t size = class_size(index);
+    struct chain *top, *seen;
+    void *head = NULL;
+    char *p;
+
+    _lock_acquire(&sc->lock);
+
+    if ((top = (struct chain*)sc->freed) != NULL) {
+        /*
+            Only pushes can race with us, so the top can't be popped
+            and pushed back in between (no ABA) and top->older is stable.
+        */
+        while ((seen = (struct chain*)_atomic_casptr(&sc->freed, top, top->older)) != top)
+            top = seen;
+
+        _lock_release(&sc->lock);
+        *count = top->count;
+
+        return top;
+    }
+
+    for (*count = 0; *count < n; ++*count) {
+        if ((size_t)(sc->end - sc->bump) < size) {
+            char *slab = (char*)_sys_pagealloc(_SLABSIZE, _SLABSIZE);
+
+            if (!slab)
+                break;
+
+            slab_class[(uintptr_t)slab >> _SLABSHIFT] = (unsigned char)(index + 1);
+            sc->bump = slab;
+            sc->end = slab + _SLABSIZE;
+        }
+
+        p = sc->bump;
+        sc->bump += size;
+        *(void**)p = head;
+        head = p;
+    }
+
+    _lock_release(&sc->lock);
+
+    return head;
+}
+
+/*
+    @description:
+        Pushes a chain of count free blocks onto a size class without
+        taking its lock. The last block of the chain must link to NULL.
+*/
+void class_give(unsigned index, void *p, unsigned count)
+{
+    struct size_class *sc = &classes[index];
+    struct chain *chain = (struct chain*)p;
+    void *top;
+
+    chain->count = count;
+
+    do
+        chain->older = (struct chain*)(top = sc->freed);
+    while (_atomic_casptr(&sc->freed, top, chain) != top);
+}
+
+/*
+    @description:
+        Maps pages for a large block with its payload at a multiple of alignment,
+        a power of two no less than the header. The mapping starts alignment
+        bytes before the payload, so it's aligned to the same.
+*/
+void *large_alloc(size_t size, size_t alignment)
+{
+    struct large *header;
+    char *map;
+
+    if (size > _LARGEMAX || alignment > _LARGEMAX - size)
+        return NULL;
+
+    if (!(map = (char*)_sys_pagealloc(alignment + size, alignment)))
+        return NULL;
+
+    header = (struct large*)(map + alignment) - 1;
+    header->size = size;
+    header->length = alignment + size;
+    header->offset = alignment;
+
+    return header + 1;
+}
+
+/*
+    @description:
+        Locates the header of a large block.
+*/
+struct large *large_header(const void *p)
+{
+    return (struct large*)p - 1;
+}
\ No newline at end of file
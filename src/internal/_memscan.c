@@ -0,0 +1,316 @@
+#include "_memscan.h"
+#include "stdint.h"
+
+/*
+    The vector kernels rely on GCC vector extensions and target attributes,
+    so other compilers (and other architectures) get the portable word-at-a-time
+    kernels only. Either way, everything is picked at runtime on first use.
+*/
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#define _MEMSCAN_VECTOR 1
+#endif
+
+/* Word-sized loads alias the character data being scanned */
+#ifdef __GNUC__
+typedef uintptr_t _word_t __attribute__((may_alias));
+#else
+typedef uintptr_t _word_t;
+#endif
+
+typedef size_t (*_scan_func_t)(const unsigned char *s, unsigned char c, size_t n);
+
+#define _ONES  ((uintptr_t)-1 / 0xff)            /* 0x0101...01 */
+#define _HIGHS (_ONES * 0x80)                    /* 0x8080...80 */
+#define _HAS_ZERO(x) (((x) - _ONES) & ~(x) & _HIGHS)
+
+/* 
+    ===================================================
+                Static helper declarations
+    ===================================================
+*/
+
+static size_t scan_init(const unsigned char *s, unsigned char c, size_t n);
+static size_t count_init(const unsigned char *s, unsigned char c, size_t n);
+static void select_kernels(void);
+static size_t scan_swar(const unsigned char *s, unsigned char c, size_t n);
+static size_t count_swar(const unsigned char *s, unsigned char c, size_t n);
+static unsigned count_bits(unsigned x);
+
+#ifdef _MEMSCAN_VECTOR
+typedef char _v16 __attribute__((vector_size(16), aligned(1), may_alias));
+typedef char _v32 __attribute__((vector_size(32), aligned(1), may_alias));
+
+static void cpuid(unsigned leaf, unsigned regs[4]);
+static int has_ymm_state(void);
+static size_t scan_sse2(const unsigned char *s, unsigned char c, size_t n);
+static size_t count_sse2(const unsigned char *s, unsigned char c, size_t n);
+static size_t scan_avx2(const unsigned char *s, unsigned char c, size_t n);
+static size_t count_avx2(const unsigned char *s, unsigned char c, size_t n);
+#endif
+
+static _scan_func_t scan_impl = scan_init;
+static _scan_func_t count_impl = count_init;
+
+/* 
+    ===================================================
+                Internal function definitions
+    ===================================================
+*/
+
+/*
+    @description:
+        Locates the first occurrence of c (converted to unsigned char)
+        in the first n characters of s. Returns its index, or n if
+        c doesn't occur.
+*/
+size_t _memscan(const void *s, int c, size_t n)
+{
+    return scan_impl((const unsigned char*)s, (unsigned char)c, n);
+}
+
+/*
+    @description:
+        Counts the occurrences of c (converted to unsigned char)
+        in the first n characters of s.
+*/
+size_t _memcount(const void *s, int c, size_t n)
+{
+    return count_impl((const unsigned char*)s, (unsigned char)c, n);
+}
+
+/* 
+    ===================================================
+                Static helper definitions
+    ===================================================
+*/
+
+/*
+    @description:
+        Picks the best kernels on the first call to _memscan.
+*/
+size_t scan_init(const unsigned char *s, unsigned char c, size_t n)
+{
+    select_kernels();
+    return scan_impl(s, c, n);
+}
+
+/*
+    @description:
+        Picks the best kernels on the first call to _memcount.
+*/
+size_t count_init(const unsigned char *s, unsigned char c, size_t n)
+{
+    select_kernels();
+    return count_impl(s, c, n);
+}
+
+/*
+    @description:
+        Selects the widest kernels supported by the running processor.
+        Racing threads all arrive at the same answer, so no lock is needed.
+*/
+void select_kernels(void)
+{
+    _scan_func_t scan = scan_swar;
+    _scan_func_t count = count_swar;
+
+#ifdef _MEMSCAN_VECTOR
+    unsigned regs[4];
+
+    cpuid(0, regs);
+
+    if (regs[0] >= 1) {
+        unsigned max_leaf = regs[0];
+
+        cpuid(1, regs);
+
+        /* EDX bit 26: SSE2 */
+        if (regs[3] & (1u << 26)) {
+            scan = scan_sse2;
+            count = count_sse2;
+        }
+
+        /* ECX bit 27: OSXSAVE, and the OS must also save YMM state */
+        if (max_leaf >= 7 && regs[2] & (1u << 27) && has_ymm_state()) {
+            cpuid(7, regs);
+
+            /* EBX bit 5: AVX2 */
+            if (regs[1] & (1u << 5)) {
+                scan = scan_avx2;
+                count = count_avx2;
+            }
+        }
+    }
+#endif
+
+    scan_impl = scan;
+    count_impl = count;
+}
+
+/*
+    @description:
+        Portable scan kernel that tests a machine word at a time.
+*/
+size_t scan_swar(const unsigned char *s, unsigned char c, size_t n)
+{
+    _word_t key = _ONES * c;
+    size_t i = 0;
+
+    /* Step up to word alignment so the wide loads never cross into an unmapped page */
+    for (; i < n && ((uintptr_t)&s[i] % sizeof key) != 0; ++i) {
+        if (s[i] == c)
+            return i;
+    }
+
+    for (; n - i >= sizeof key; i += sizeof key) {
+        _word_t x = *(const _word_t*)&s[i] ^ key;
+
+        if (_HAS_ZERO(x))
+            break;
+    }
+
+    for (; i < n; ++i) {
+        if (s[i] == c)
+            return i;
+    }
+
+    return n;
+}
+
+/*
+    @description:
+        Portable count kernel that tests a machine word at a time.
+*/
+size_t count_swar(const unsigned char *s, unsigned char c, size_t n)
+{
+    size_t count = 0;
+    size_t i;
+
+    /* Scanning is word-at-a-time, so counting hops from match to match */
+    for (i = scan_swar(s, c, n); i < n; i += 1 + scan_swar(&s[i + 1], c, n - i - 1))
+        ++count;
+
+    return count;
+}
+
+/*
+    @description:
+        Counts the set bits in x without relying on compiler support routines.
+*/
+unsigned count_bits(unsigned x)
+{
+    x = x - ((x >> 1) & 0x55555555u);
+    x = (x & 0x33333333u) + ((x >> 2) & 0x33333333u);
+    x = (x + (x >> 4)) & 0x0f0f0f0fu;
+
+    return (x * 0x01010101u) >> 24;
+}
+
+#ifdef _MEMSCAN_VECTOR
+/*
+    @description:
+        Executes CPUID for the requested leaf (subleaf 0).
+*/
+void cpuid(unsigned leaf, unsigned regs[4])
+{
+    __asm__ volatile ("cpuid"
+        : "=a"(regs[0]), "=b"(regs[1]), "=c"(regs[2]), "=d"(regs[3])
+        : "a"(leaf), "c"(0));
+}
+
+/*
+    @description:
+        Checks through XGETBV that the OS preserves both XMM and YMM registers.
+*/
+int has_ymm_state(void)
+{
+    unsigned lo, hi;
+
+    __asm__ volatile (".byte 0x0f, 0x01, 0xd0" : "=a"(lo), "=d"(hi) : "c"(0));
+
+    return (lo & 0x6) == 0x6;
+}
+
+/*
+    @description:
+        SSE2 scan kernel, 16 characters per step.
+*/
+__attribute__((target("sse2")))
+size_t scan_sse2(const unsigned char *s, unsigned char c, size_t n)
+{
+    _v16 key = (_v16){0} + (char)c;
+    size_t i;
+
+    for (i = 0; n - i >= sizeof key; i += sizeof key) {
+        unsigned mask = __builtin_ia32_pmovmskb128(*(const _v16*)&s[i] == key);
+
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+
+    for (; i < n; ++i) {
+        if (s[i] == c)
+            return i;
+    }
+
+    return n;
+}
+
+/*
+    @description:
+        SSE2 count kernel, 16 characters per step.
+*/
+__attribute__((target("sse2")))
+size_t count_sse2(const unsigned char *s, unsigned char c, size_t n)
+{
+    _v16 key = (_v16){0} + (char)c;
+    size_t count = 0;
+    size_t i;
+
+    for (i = 0; n - i >= sizeof key; i += sizeof key)
+        count += count_bits(__builtin_ia32_pmovmskb128(*(const _v16*)&s[i] == key));
+
+    for (; i < n; ++i)
+        count += s[i] == c;
+
+    return count;
+}
+
+/*
+    @description:
+        AVX2 scan kernel, 32 characters per step.
+*/
+__attribute__((target("avx2")))
+size_t scan_avx2(const unsigned char *s, unsigned char c, size_t n)
+{
+    _v32 key = (_v32){0} + (char)c;
+    size_t i;
+
+    for (i = 0; n - i >= sizeof key; i += sizeof key) {
+        unsigned mask = __builtin_ia32_pmovmskb256(*(const _v32*)&s[i] == key);
+
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+
+    /* The remainder is less than one full step, which SSE2 handles just fine */
+    return i + scan_sse2(&s[i], c, n - i);
+}
+
+/*
+    @description:
+        AVX2 count kernel, 32 characters per step.
+*/
+__attribute__((target("avx2")))
+size_t count_avx2(const unsigned char *s, unsigned char c, size_t n)
+{
+    _v32 key = (_v32){0} + (char)c;
+    size_t count = 0;
+    size_t i;
+
+    for (i = 0; n - i >= sizeof key; i += sizeof key)
+        count += count_bits(__builtin_ia32_pmovmskb256(*(const _v32*)&s[i] == key));
+
+    return count + count_sse2(&s[i], c, n - i);
+}
+#endif /* _MEMSCAN_VECTOR */
\ No newline at end of file
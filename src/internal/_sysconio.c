@@ -1,3 +1,5 @@
+#if defined(_WIN32)
+
 #include "_system.h"
 #include "conio.h"
 #include "stdbool.h"
@@ -211,4 +213,262 @@ int _putch(int c)
         return EOF;
 
     return c;
-}
\ No newline at end of file
+}
+
+#elif defined(__linux__)
+
+#include "_system.h"
+#include "conio.h"
+#include "stdbool.h"
+#include "stdio.h"
+#include "string.h"
+
+#define _NR_IOCTL 54
+#define _NR_POLL  168
+
+#define _LNX_TCGETS 0x5401
+#define _LNX_TCSETS 0x5402
+#define _LNX_ICANON 0x0002
+#define _LNX_ECHO   0x0008
+#define _LNX_VTIME  5
+#define _LNX_VMIN   6
+#define _LNX_POLLIN 0x0001
+
+/* Kernel termios, as TCGETS and TCSETS see it */
+struct sys_termios {
+    unsigned      c_iflag;
+    unsigned      c_oflag;
+    unsigned      c_cflag;
+    unsigned      c_lflag;
+    unsigned char c_line;
+    unsigned char c_cc[19];
+};
+
+struct sys_pollfd {
+    int   fd;
+    short events;
+    short revents;
+};
+
+static bool unget_avail;  /* True if a character is available for ungetch */
+static int unget_char;
+
+static bool raw_mode(struct sys_termios *saved);
+static void restore_mode(const struct sys_termios *saved);
+static bool cursor_position(int *x, int *y);
+static int write_seq(const char *s);
+
+/*
+    @description:
+        Clears the visible console output buffer.
+*/
+void _clrscr(void)
+{
+    /* Erase the display, then home the cursor */
+    write_seq("\033[2J\033[H");
+}
+
+/*
+    @description:
+        Sets the position of the console cursor.
+*/
+void _gotoxy(int x, int y)
+{
+    char seq[32];
+
+    /* Conio positions are 1-based, and so are the terminal's */
+    sprintf(seq, "\033[%d;%dH", y, x);
+    write_seq(seq);
+}
+
+/*
+    @description:
+        Gets the X coordinate of the console cursor.
+*/
+int _wherex(void)
+{
+    int x, y;
+
+    return cursor_position(&x, &y) ? x : -1;
+}
+
+/*
+    @description:
+        Gets the Y coordinate of the console cursor.
+*/
+int _wherey(void)
+{
+    int x, y;
+
+    return cursor_position(&x, &y) ? y : -1;
+}
+
+/*
+    @description:
+        Checks the console (keyboard) buffer for a key stroke.
+*/
+int _kbhit(void)
+{
+    struct sys_termios saved;
+    struct sys_pollfd pfd;
+    long rc;
+
+    if (unget_avail)
+        return 1;
+
+    /* Without canonical mode a key is readable as soon as it's pressed */
+    if (!raw_mode(&saved))
+        return 0;
+
+    pfd.fd = (int)(long)__sys_stdin;
+    pfd.events = _LNX_POLLIN;
+    pfd.revents = 0;
+
+    rc = _sys_linux_call(_NR_POLL, (long)&pfd, 1, 0, 0, 0, 0);
+    restore_mode(&saved);
+
+    return rc > 0 && (pfd.revents & _LNX_POLLIN);
+}
+
+/*
+    @description:
+        Retrieves a character directly from the console (keyboard) buffer without echo.
+*/
+int _getch(void)
+{
+    if (unget_avail) {
+        /* There was a preceding ungetch */
+        unget_avail = false;
+        return unget_char;
+    }
+    else {
+        /* No ungetch, so read a raw character (extended keys arrive as escape sequences) */
+        struct sys_termios saved;
+        bool raw = raw_mode(&saved);
+        unsigned char ch;
+        int n = _sys_read(__sys_stdin, &ch, 1);
+
+        if (raw)
+            restore_mode(&saved);
+
+        return n == 1 ? ch : EOF;
+    }
+}
+
+/*
+    @description:
+        Retrieves a character directly from the console (keyboard) buffer with echo.
+*/
+int _getche(void)
+{
+    return _putch(_getch());
+}
+
+/*
+    @description:
+        Returns a previously retrieved console character such 
+        that the next getch will retrieve it again.
+*/
+int _ungetch(int c)
+{
+    if (unget_avail)
+        return EOF; /* Only allow one ungetch at a time */
+
+    unget_avail = true;
+    unget_char = c;
+
+    return c;
+}
+
+/*
+    @description:
+        Writes a character directly to the console (screen) buffer.
+*/
+int _putch(int c)
+{
+    char ch = (char)c;
+
+    if (_sys_write(__sys_stdout, &ch, 1) != 1)
+        return EOF;
+
+    return c;
+}
+
+/*
+    @description:
+        Switches the terminal to unbuffered input without echo, saving
+        the previous mode. Returns false if stdin isn't a terminal.
+*/
+bool raw_mode(struct sys_termios *saved)
+{
+    struct sys_termios raw;
+
+    if (_sys_linux_call(_NR_IOCTL, (long)__sys_stdin, _LNX_TCGETS, (long)saved, 0, 0, 0) != 0)
+        return false;
+
+    raw = *saved;
+    raw.c_lflag &= ~(_LNX_ICANON | _LNX_ECHO);
+    raw.c_cc[_LNX_VMIN] = 1;
+    raw.c_cc[_LNX_VTIME] = 0;
+
+    return _sys_linux_call(_NR_IOCTL, (long)__sys_stdin, _LNX_TCSETS, (long)&raw, 0, 0, 0) == 0;
+}
+
+/*
+    @description:
+        Restores a terminal mode saved by raw_mode.
+*/
+void restore_mode(const struct sys_termios *saved)
+{
+    _sys_linux_call(_NR_IOCTL, (long)__sys_stdin, _LNX_TCSETS, (long)saved, 0, 0, 0);
+}
+
+/*
+    @description:
+        Asks the terminal for the cursor position and parses its
+        "ESC [ row ; col R" report. Returns false if there's no answer.
+*/
+bool cursor_position(int *x, int *y)
+{
+    struct sys_termios saved;
+    int *field = y;
+    bool ok = false;
+    char ch;
+
+    if (!raw_mode(&saved))
+        return false;
+
+    if (write_seq("\033[6n") && _sys_read(__sys_stdin, &ch, 1) == 1 && ch == '\033'
+        && _sys_read(__sys_stdin, &ch, 1) == 1 && ch == '[')
+    {
+        *x = *y = 0;
+
+        while (_sys_read(__sys_stdin, &ch, 1) == 1) {
+            if (ch >= '0' && ch <= '9')
+                *field = *field * 10 + (ch - '0');
+            else if (ch == ';' && field == y)
+                field = x;
+            else {
+                ok = ch == 'R' && field == x;
+                break;
+            }
+        }
+    }
+
+    restore_mode(&saved);
+
+    return ok;
+}
+
+/*
+    @description:
+        Writes a control sequence straight to the terminal.
+*/
+int write_seq(const char *s)
+{
+    int n = (int)strlen(s);
+
+    return _sys_write(__sys_stdout, (void*)s, n) == n;
+}
+
+#endif /* __linux__ */
\ No newline at end of file
@@ -1,3 +1,5 @@
+#if defined(_WIN32)
+
 #include "_syslocale.h"
 #include "locale.h"
 #include "stdlib.h"
@@ -451,4 +453,69 @@ BOOL CALLBACK find_locale(LPWSTR name, DWORD flags, LPARAM requested_locale)
     }
 
     return TRUE;
-}
\ No newline at end of file
+}
+
+#elif defined(__linux__)
+
+#include "_system.h"
+#include "_syslocale.h"
+#include "locale.h"
+#include "string.h"
+
+/* There's no system locale database to draw on, so the "C" locale is the only one */
+
+/* 
+    ===================================================
+              Public function definitions
+    ===================================================
+*/
+
+/*
+    @description:
+        Retrieves the default locale name for the system as a shared string.
+*/
+char *_sys_local_localename(void)
+{
+    return "C";
+}
+
+/*
+    @description:
+        Looks for an installed locale with the given name. None are
+        installed, so this always fails.
+*/
+int _sys_load_locale(const char *name, _locale *loc)
+{
+    (void)name; /* Suppress unused variable warnings */
+    (void)loc;
+
+    return 0;
+}
+
+/*
+    @description:
+        Compares two strings according to the specified locale ID.
+        Only the "C" locale exists, so this is strcmp.
+*/
+int _sys_strcoll(unsigned long lcid, const char *a, const char *b)
+{
+    (void)lcid;
+
+    return strcmp(a, b);
+}
+
+/*
+    @description:
+        Transforms a string for comparison according to the specified
+        locale ID. Only the "C" locale exists, so this is a copy.
+*/
+int _sys_strxfrm(unsigned long lcid, const char *dst, const char *src)
+{
+    (void)lcid;
+
+    strcpy((char*)dst, src);
+
+    return (int)strlen(src);
+}
+
+#endif /* __linux__ */
\ No newline at end of file
@@ -1,3 +1,5 @@
+#if defined(_WIN32)
+
 #include "_system.h"
 #include "errno.h"
 #include "string.h"
@@ -9,6 +11,18 @@ _sys_handle_t __sys_stdin;
 _sys_handle_t __sys_stdout;
 _sys_handle_t __sys_stderr;
 
+/* TLS slot behind _sys_thread_data, allocated on first use */
+static volatile LONG thread_data_index = (LONG)TLS_OUT_OF_INDEXES;
+
+/* Called by every created thread as it finishes, see _sys_thread_atexit */
+static void (*volatile thread_exit_hook)(void);
+
+/* Entry point and argument handed from _sys_thread_create to the new thread */
+struct sys_thread_start {
+    void (*fn)(void*);
+    void  *arg;
+};
+
 /* 
     ===================================================
               Public function definitions
@@ -60,6 +74,149 @@ void _sys_exit(int status)
     TerminateThread(GetCurrentThread(), status);
 }
 
+/*
+    @description:
+        Retrieves a unique nonzero identifier for the calling thread.
+*/
+unsigned long _sys_thread_self(void)
+{
+    return GetCurrentThreadId();
+}
+
+/*
+    @description:
+        Allocates the TLS slot for _sys_thread_data once, whichever thread gets there first.
+*/
+static DWORD thread_data_slot(void)
+{
+    if (thread_data_index == (LONG)TLS_OUT_OF_INDEXES) {
+        DWORD index = TlsAlloc();
+
+        if (InterlockedCompareExchange(&thread_data_index, (LONG)index, (LONG)TLS_OUT_OF_INDEXES) != (LONG)TLS_OUT_OF_INDEXES)
+            TlsFree(index);
+    }
+
+    return (DWORD)thread_data_index;
+}
+
+/*
+    @description:
+        Retrieves the library's per-thread pointer for the calling thread, NULL until set.
+*/
+void *_sys_thread_data(void)
+{
+    DWORD index = thread_data_slot();
+
+    return index == TLS_OUT_OF_INDEXES ? NULL : TlsGetValue(index);
+}
+
+/*
+    @description:
+        Sets the library's per-thread pointer for the calling thread.
+*/
+void _sys_thread_setdata(void *data)
+{
+    DWORD index = thread_data_slot();
+
+    if (index != TLS_OUT_OF_INDEXES)
+        TlsSetValue(index, data);
+}
+
+/*
+    @description:
+        Sets the function that a thread made by _sys_thread_create calls
+        once its entry point returns, so the library can release what it
+        keeps per thread. There's one hook for the whole process.
+*/
+void _sys_thread_atexit(void (*fn)(void))
+{
+    thread_exit_hook = fn;
+}
+
+/*
+    @description:
+        Adapts a _sys_thread_create entry point to a Win32 thread procedure.
+*/
+static DWORD WINAPI thread_start(LPVOID param)
+{
+    struct sys_thread_start start = *(struct sys_thread_start*)param;
+
+    _sys_free(param);
+    start.fn(start.arg);
+
+    if (thread_exit_hook)
+        thread_exit_hook();
+
+    return 0;
+}
+
+/*
+    @description:
+        Starts a thread running fn(arg) and returns a handle for
+        _sys_thread_join, or _SYS_BADHANDLE on failure.
+*/
+_sys_handle_t _sys_thread_create(void (*fn)(void *arg), void *arg)
+{
+    struct sys_thread_start *start = (struct sys_thread_start*)_sys_alloc(sizeof *start);
+    HANDLE thread;
+
+    if (!start)
+        return _SYS_BADHANDLE;
+
+    start->fn = fn;
+    start->arg = arg;
+
+    if (!(thread = CreateThread(NULL, 0, thread_start, start, 0, NULL))) {
+        _sys_free(start);
+        return _SYS_BADHANDLE;
+    }
+
+    return thread;
+}
+
+/*
+    @description:
+        Waits for a thread made by _sys_thread_create to finish and
+        releases its resources.
+*/
+void _sys_thread_join(_sys_handle_t thread)
+{
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+}
+
+/*
+    @description:
+        Blocks while the value at addr equals value (or until woken).
+*/
+void _sys_wait(volatile int *addr, int value)
+{
+    /* XP has no address wait, so contended waiters just give up their time slice */
+    (void)addr;
+    (void)value;
+    SwitchToThread();
+}
+
+/*
+    @description:
+        Wakes up to n threads blocked in _sys_wait on addr.
+*/
+void _sys_wake(volatile int *addr, int n)
+{
+    /* Waiters poll (see _sys_wait) */
+    (void)addr;
+    (void)n;
+}
+
+/*
+    @description:
+        Gives up the rest of the calling thread's time slice.
+*/
+void _sys_yield(void)
+{
+    SwitchToThread();
+}
+
 /*
     @description:
         Retrieve the requested environment variable by name.
@@ -123,6 +280,80 @@ void _sys_free(void *p)
         GlobalFree(p);
 }
 
+/*
+    @description:
+        Commit zeroed pages for the specified number of bytes starting at a
+        multiple of align, which must be a power of two. Returns NULL on failure.
+*/
+void *_sys_pagealloc(unsigned bytes, unsigned align)
+{
+    SIZE_T granularity = 65536; /* VirtualAlloc reservations are always aligned to this */
+    SIZE_T reserve = (bytes + granularity - 1) & ~(granularity - 1);
+    char *p = NULL;
+    int tries;
+
+    /*
+        Reserve whole granules, since the rest of the last one can't be used
+        by anything else anyway, and leave it for _sys_pageremap to grow into.
+    */
+    if (align <= granularity)
+        p = (char*)VirtualAlloc(NULL, reserve, MEM_RESERVE, PAGE_NOACCESS);
+    else {
+        /* Find a big enough hole, then claim its aligned part (another thread may race us to it) */
+        for (tries = 0; !p && tries < 8; ++tries) {
+            if (!(p = (char*)VirtualAlloc(NULL, reserve + align, MEM_RESERVE, PAGE_NOACCESS)))
+                return NULL;
+
+            VirtualFree(p, 0, MEM_RELEASE);
+            p = (char*)(((SIZE_T)p + align - 1) & ~(SIZE_T)(align - 1));
+            p = (char*)VirtualAlloc(p, reserve, MEM_RESERVE, PAGE_NOACCESS);
+        }
+    }
+
+    if (p && !VirtualAlloc(p, bytes, MEM_COMMIT, PAGE_READWRITE)) {
+        VirtualFree(p, 0, MEM_RELEASE);
+        p = NULL;
+    }
+
+    return p;
+}
+
+/*
+    @description:
+        Resize pages from _sys_pagealloc. Committed pages can't be moved,
+        so they only grow into the rest of their reservation, and shrinking
+        decommits the tail. Returns p, or NULL with the pages left untouched.
+*/
+void *_sys_pageremap(void *p, unsigned old, unsigned bytes)
+{
+    SIZE_T granularity = 65536;
+    SIZE_T page = 4096;
+    SIZE_T from = (old + page - 1) & ~(page - 1);
+    SIZE_T to = (bytes + page - 1) & ~(page - 1);
+
+    if (to > ((old + granularity - 1) & ~(granularity - 1)))
+        return NULL;
+
+    if (to > from) {
+        if (!VirtualAlloc((char*)p + from, to - from, MEM_COMMIT, PAGE_READWRITE))
+            return NULL;
+    }
+    else if (to < from)
+        VirtualFree((char*)p + to, from - to, MEM_DECOMMIT);
+
+    return p;
+}
+
+/*
+    @description:
+        Release pages from _sys_pagealloc. Do nothing if p is NULL.
+*/
+void _sys_pagefree(void *p, unsigned bytes)
+{
+    if (p)
+        VirtualFree(p, 0, MEM_RELEASE);
+}
+
 /*
     @description:
         Create a new heap for use with _sys_heapalloc, _sys_heaprealloc, and _sysheapfree.
@@ -222,6 +453,7 @@ int _sys_parse_openmode(const char *mode, unsigned *flag, int *orient, int *attr
             STANDARD_RIGHTS_WRITE | 
             SYNCHRONIZE;
         *attr = CREATE_NEW | OPEN_EXISTING;
+        *flag |= 0x0008; /* Writes always go to the end (see stdio.h) */
         *share = FILE_SHARE_WRITE;
         break;
     default:
@@ -253,11 +485,19 @@ int _sys_parse_openmode(const char *mode, unsigned *flag, int *orient, int *attr
             /* Disable sharing */
             *share = 0;
             break;
+        case 'm':
+            /* Read through a file mapping instead of a buffer (see stdio.h) */
+            *flag |= 0x1000;
+            break;
         default:
             return 0; /* Invalid mode */
         }
     }
 
+    /* Mappings are read-only */
+    if (*flag & 0x1000 && *orient != GENERIC_READ)
+        return 0; /* Invalid mode */
+
     return 1;
 }
 
@@ -307,6 +547,34 @@ int _sys_read(_sys_handle_t fd, void *p, int n)
     return nread;
 }
 
+/*
+    @description:
+        Reads into n blocks in order. Like _sys_read, fewer bytes
+        than requested may be read.
+*/
+int _sys_readv(_sys_handle_t fd, struct _sys_iovec *iov, int n)
+{
+    int nread = 0;
+
+    /* ReadFileScatter only takes page-sized blocks on unbuffered handles */
+    while (n-- > 0) {
+        int rc = _sys_read(fd, iov->base, iov->len);
+
+        if (rc < 0)
+            return nread > 0 ? nread : -1;
+
+        nread += rc;
+
+        /* A short read ends the transfer, the same as readv */
+        if ((unsigned)rc < iov->len)
+            break;
+
+        ++iov;
+    }
+
+    return nread;
+}
+
 /*
     @description:
         Attempt to write n bytes from the array pointed to by p to the specified file.
@@ -321,6 +589,134 @@ int _sys_write(_sys_handle_t fd, void *p, int n)
     return nwritten;
 }
 
+/*
+    @description:
+        Writes n blocks to the specified file in order.
+*/
+int _sys_writev(_sys_handle_t fd, struct _sys_iovec *iov, int n)
+{
+    int nwritten = 0;
+
+    /* WriteFileGather only takes page-sized blocks on unbuffered handles */
+    while (n-- > 0) {
+        char *p = (char*)iov->base;
+        int len = (int)iov->len;
+
+        /* Pipes and consoles may accept less than everything, so keep going */
+        while (len > 0) {
+            int rc = _sys_write(fd, p, len);
+
+            if (rc < 0)
+                return -1;
+            else if (rc == 0)
+                return nwritten; /* No progress, so the caller sees a short count */
+
+            nwritten += rc;
+            p += rc;
+            len -= rc;
+        }
+
+        ++iov;
+    }
+
+    return nwritten;
+}
+
+/*
+    @description:
+        Attempt to read n bytes at offset into the array pointed to by p,
+        leaving the file position where it was.
+*/
+int _sys_pread(_sys_handle_t fd, void *p, int n, long long offset)
+{
+    OVERLAPPED ov = {0};
+    LARGE_INTEGER pos;
+    LARGE_INTEGER zero;
+    DWORD nread = 0;
+    int rc = 0;
+
+    /* Synchronous handles move the file pointer even with an offset, so put it back after */
+    zero.QuadPart = 0;
+
+    if (!SetFilePointerEx(fd, zero, &pos, FILE_CURRENT))
+        return -1;
+
+    ov.Offset = (DWORD)(offset & 0xffffffff);
+    ov.OffsetHigh = (DWORD)(offset >> 32);
+
+    if (!ReadFile(fd, p, n, &nread, &ov) && GetLastError() != ERROR_HANDLE_EOF)
+        rc = -1;
+
+    SetFilePointerEx(fd, pos, NULL, FILE_BEGIN);
+
+    return rc < 0 ? rc : (int)nread;
+}
+
+/*
+    @description:
+        Attempt to write n bytes from the array pointed to by p at offset,
+        leaving the file position where it was.
+*/
+int _sys_pwrite(_sys_handle_t fd, void *p, int n, long long offset)
+{
+    OVERLAPPED ov = {0};
+    LARGE_INTEGER pos;
+    LARGE_INTEGER zero;
+    DWORD nwritten = 0;
+    int rc = 0;
+
+    zero.QuadPart = 0;
+
+    if (!SetFilePointerEx(fd, zero, &pos, FILE_CURRENT))
+        return -1;
+
+    ov.Offset = (DWORD)(offset & 0xffffffff);
+    ov.OffsetHigh = (DWORD)(offset >> 32);
+
+    if (n > 0 && !WriteFile(fd, p, n, &nwritten, &ov))
+        rc = -1;
+
+    SetFilePointerEx(fd, pos, NULL, FILE_BEGIN);
+
+    return rc < 0 ? rc : (int)nwritten;
+}
+
+/*
+    @description:
+        Copies up to n bytes from src to dst without them leaving the
+        kernel. Windows has no such call for open handles, so this
+        always returns -1 and the caller copies through memory.
+*/
+int _sys_copy(_sys_handle_t dst, _sys_handle_t src, int n)
+{
+    /* Suppressing unused parameter warnings */
+    (void)dst;
+    (void)src;
+    (void)n;
+
+    return -1;
+}
+
+/*
+    @description:
+        Performs n independent reads and writes, each at its file's
+        current position. Each request gets its own result.
+*/
+int _sys_iobatch(struct _sys_ioreq *req, int n)
+{
+    int i;
+
+    /* Overlapped I/O can't use the file position, so these are plain calls */
+    for (i = 0; i < n; ++i) {
+        if (req[i].write)
+            req[i].result = _sys_write(req[i].fd, req[i].buf, req[i].len);
+        else
+            req[i].result = _sys_read(req[i].fd, req[i].buf, req[i].len);
+    }
+
+    return n;
+}
+
 /*
     @description:
         Retrieve the current file position indicator for the specified file.
@@ -351,6 +747,64 @@ int _sys_seek(_sys_handle_t fd, long long offset, int whence)
     return pos.LowPart == INVALID_SET_FILE_POINTER && GetLastError() != NO_ERROR;
 }
 
+/*
+    @description:
+        Retrieve the size in bytes of the specified file.
+*/
+int _sys_filesize(_sys_handle_t fd, long long *size)
+{
+    LARGE_INTEGER sys_size;
+
+    if (!GetFileSizeEx(fd, &sys_size)) {
+        *size = 0;
+        return 1;
+    }
+
+    *size = sys_size.QuadPart;
+
+    return 0;
+}
+
+/*
+    @description:
+        Retrieve the preferred I/O size for the specified file, or 0 if
+        it isn't a disk file (eg. a console or pipe).
+*/
+unsigned _sys_blksize(_sys_handle_t fd)
+{
+    /* XP has no per-handle query for this, so assume the default NTFS cluster */
+    return GetFileType(fd) == FILE_TYPE_DISK ? 4096 : 0;
+}
+
+/*
+    @description:
+        Map bytes of the specified file, starting at offset, into memory for reading.
+*/
+void *_sys_map(_sys_handle_t fd, long long offset, unsigned bytes)
+{
+    HANDLE mapping = CreateFileMapping(fd, 0, PAGE_READONLY, 0, 0, 0);
+    void *p = 0;
+
+    if (mapping) {
+        p = MapViewOfFile(mapping, FILE_MAP_READ, (DWORD)(offset >> 32), (DWORD)offset, bytes);
+
+        /* The view keeps the mapping object alive */
+        CloseHandle(mapping);
+    }
+
+    return p;
+}
+
+/*
+    @description:
+        Release a mapping previously created with _sys_map.
+*/
+void _sys_unmap(void *p, unsigned bytes)
+{
+    (void)bytes;
+    UnmapViewOfFile(p);
+}
+
 /*
     @description:
         Delete the specified file by name.
@@ -410,4 +864,6 @@ int _sys_wctomb(char *s, const wchar_t *wc, int n)
         return -1;
 
     return WideCharToMultiByte(CP_THREAD_ACP, 0, wc, n, s, len, '\0', 0);
-}
\ No newline at end of file
+}
+
+#endif /* _WIN32 */
@@ -0,0 +1,1693 @@
+#if defined(__linux__)
+
+#include "_system.h"
+#include "errno.h"
+#include "string.h"
+#include "wchar.h"
+
+/*
+    This backend talks to the kernel directly through the i386 system call
+    interface (int 0x80), matching the ILP32/cdecl model the rest of the
+    library is built around. It also runs on x86-64 kernels with IA32
+    emulation enabled.
+*/
+#if !defined(__i386__)
+#error "The Linux system backend requires an i386 target"
+#endif
+
+/* System call numbers from the i386 kernel ABI */
+#define _NR_EXIT        1
+#define _NR_READ        3
+#define _NR_WRITE       4
+#define _NR_CLOSE       6
+#define _NR_EXECVE      11
+#define _NR_GETPID      20
+#define _NR_MUNMAP      91
+#define _NR_WAIT4       114
+#define _NR_CLONE       120
+#define _NR_LLSEEK      140
+#define _NR_READV       145
+#define _NR_WRITEV      146
+#define _NR_SCHED_YIELD 158
+#define _NR_MREMAP      163
+#define _NR_PREAD64     180
+#define _NR_PWRITE64    181
+#define _NR_MMAP2       192
+#define _NR_FSTAT64     197
+#define _NR_MADVISE     219
+#define _NR_SENDFILE64  239
+#define _NR_FUTEX       240
+#define _NR_SET_TLS     243 /* set_thread_area */
+#define _NR_EXIT_GROUP  252
+#define _NR_OPENAT      295
+#define _NR_UNLINKAT    301
+#define _NR_RENAMEAT    302
+#define _NR_COPY_RANGE  377 /* copy_file_range */
+#define _NR_URING_SETUP 425
+#define _NR_URING_ENTER 426
+
+/* Kernel error numbers that need translating to errno.h values */
+#define _LNX_EPERM      1
+#define _LNX_ENOENT     2
+#define _LNX_EINTR      4
+#define _LNX_EACCES     13
+#define _LNX_EEXIST     17
+#define _LNX_ENOTDIR    20
+#define _LNX_ENFILE     23
+#define _LNX_EMFILE     24
+#define _LNX_EROFS      30
+#define _LNX_ENOSYS     38
+
+/* Flag values for openat, mmap2, madvise, mremap, futex, set_thread_area, and clone */
+#define _LNX_AT_FDCWD   (-100)
+#define _LNX_O_RDONLY   00
+#define _LNX_O_WRONLY   01
+#define _LNX_O_RDWR     02
+#define _LNX_O_CREAT    0100
+#define _LNX_O_EXCL     0200
+#define _LNX_O_TRUNC    01000
+#define _LNX_O_APPEND   02000
+#define _LNX_O_LARGE    0100000
+#define _LNX_O_CLOEXEC  02000000
+#define _LNX_PROT_READ  0x1
+#define _LNX_PROT_RW    0x3
+#define _LNX_MAP_SHARED 0x01
+#define _LNX_MAP_ANON   0x22 /* MAP_PRIVATE | MAP_ANONYMOUS */
+#define _LNX_MADV_SEQ   2    /* MADV_SEQUENTIAL */
+#define _LNX_MREMAP_MOV 1
+#define _LNX_SIGCHLD    17
+#define _LNX_FUTEX_WAIT 128  /* FUTEX_WAIT | FUTEX_PRIVATE_FLAG */
+#define _LNX_FUTEX_WAKE 129  /* FUTEX_WAKE | FUTEX_PRIVATE_FLAG */
+#define _LNX_FUTEX_TID  0    /* FUTEX_WAIT, shared to match the kernel's wake on thread exit */
+#define _LNX_CLONE_THR  0x3d0f00 /* VM|FS|FILES|SIGHAND|THREAD|SYSVSEM|SETTLS|PARENT_SETTID|CHILD_CLEARTID */
+#define _LNX_TLS_FLAGS  0x51 /* seg_32bit | limit_in_pages | useable */
+
+#define _LNX_URING_READ  22      /* IORING_OP_READ */
+#define _LNX_URING_WRITE 23      /* IORING_OP_WRITE */
+#define _LNX_URING_WAIT  1       /* IORING_ENTER_GETEVENTS */
+#define _LNX_URING_CQ    0x8000  /* IORING_OFF_CQ_RING in pages, for mmap2 */
+#define _LNX_URING_SQES  0x10000 /* IORING_OFF_SQES in pages, for mmap2 */
+
+#define _LNX_S_IFMT     0170000
+#define _LNX_S_IFREG    0100000
+
+#define _PAGE_SIZE      4096
+#define _IOV_MAX        1024 /* Most blocks one readv or writev call accepts */
+#define _URING_ENTRIES  64   /* Submission queue size, and so the most requests per batch */
+#define _TMP_NAME_MAX   255 /* Matches FILENAME_MAX in stdio.h */
+#define _THREAD_STACK   0x40000 /* Stack (and control block) mapping for created threads */
+
+/* Failed system calls return a negated error number in [-4095,-1] */
+#define _sys_failed(rc) ((unsigned long)(rc) > (unsigned long)-4096)
+
+/* struct stat64 from the i386 kernel ABI */
+struct sys_stat64 {
+    unsigned long long dev;
+    unsigned char      pad0[4];
+    unsigned long      ino_lo;
+    unsigned int       mode;
+    unsigned int       nlink;
+    unsigned long      uid;
+    unsigned long      gid;
+    unsigned long long rdev;
+    unsigned char      pad3[4];
+    long long          size;
+    unsigned long      blksize;
+    unsigned long long blocks;
+    unsigned long      times[6];
+    unsigned long long ino;
+};
+
+/* struct user_desc from the i386 kernel ABI */
+struct sys_user_desc {
+    unsigned int  entry_number;
+    unsigned long base_addr;
+    unsigned int  limit;
+    unsigned int  flags;
+};
+
+/* struct io_uring_params (and its ring offsets) from the kernel ABI */
+struct sys_uring_params {
+    unsigned sq_entries;
+    unsigned cq_entries;
+    unsigned flags;
+    unsigned sq_thread_cpu;
+    unsigned sq_thread_idle;
+    unsigned features;
+    unsigned wq_fd;
+    unsigned resv[3];
+    struct {
+        unsigned head, tail, ring_mask, ring_entries, flags, dropped, array, resv1;
+        unsigned long long user_addr;
+    } sq_off;
+    struct {
+        unsigned head, tail, ring_mask, ring_entries, overflow, cqes, flags, resv1;
+        unsigned long long user_addr;
+    } cq_off;
+};
+
+/* struct io_uring_sqe, trimmed to the fields used for reads and writes */
+struct sys_uring_sqe {
+    unsigned char      opcode;
+    unsigned char      flags;
+    unsigned short     ioprio;
+    int                fd;
+    unsigned long long off;
+    unsigned long long addr;
+    unsigned           len;
+    unsigned           rw_flags;
+    unsigned long long user_data;
+    unsigned long long pad[3];
+};
+
+/* struct io_uring_cqe from the kernel ABI */
+struct sys_uring_cqe {
+    unsigned long long user_data;
+    int                res;
+    unsigned           flags;
+};
+
+/* The process-wide ring that _sys_iobatch submits through */
+struct sys_uring {
+    int                   state;    /* 0: not set up yet, 1: ready, -1: unavailable */
+    volatile int          lock;     /* Serializes batches from multiple threads */
+    int                   fd;       /* The ring's file descriptor */
+    volatile unsigned    *sq_head;  /* Consumed by the kernel */
+    volatile unsigned    *sq_tail;  /* Produced by us */
+    unsigned             *sq_array; /* Indices into sqes, in submission order */
+    unsigned              sq_mask;
+    struct sys_uring_sqe *sqes;
+    volatile unsigned    *cq_head;  /* Consumed by us */
+    volatile unsigned    *cq_tail;  /* Produced by the kernel */
+    unsigned              cq_mask;
+    struct sys_uring_cqe *cqes;
+};
+
+/* Per-thread control block, which %gs points to */
+struct sys_thread {
+    struct sys_thread *self;       /* Must be first, %gs:0 is how a thread finds its block */
+    void             (*fn)(void*); /* Entry point of a created thread */
+    void              *arg;        /* Argument for fn */
+    volatile int       tid;        /* Kernel thread id, cleared by the kernel when the thread exits */
+    void              *map;        /* Mapping holding the stack and this block */
+    void              *data;       /* Library state for the thread, see _sys_thread_data */
+};
+
+struct sys_block {
+    struct sys_block *prev; /* Previous mapping owned by the heap */
+    struct sys_block *next; /* Next mapping owned by the heap */
+    unsigned long     size; /* Length of the mapping in bytes */
+    unsigned long     pad;  /* Keeps the payload 16 byte aligned */
+};
+
+struct sys_heap {
+    struct sys_block blocks; /* Sentinel for the circular list of mappings */
+    volatile int     lock;   /* Serializes access to the list */
+};
+
+_sys_handle_t __sys_heap;
+_sys_handle_t __sys_stdin;
+_sys_handle_t __sys_stdout;
+_sys_handle_t __sys_stderr;
+
+static int    sys_argc;    /* Argument count from the initial process stack */
+static char **sys_argv;    /* Argument vector from the initial process stack */
+static char **sys_envp;    /* Environment from the initial process stack */
+static char  *sys_cmdline; /* Lazily built command line for _sys_commandline */
+
+static struct sys_thread main_thread; /* Control block for the initial thread */
+static unsigned sys_tls_entry;        /* GDT slot that %gs selects in every thread */
+static struct sys_uring sys_ring;     /* Set up by the first _sys_iobatch */
+static int sys_no_copy_range;         /* copy_file_range isn't there (older kernels) */
+
+/* Called by every created thread as it finishes, see _sys_thread_atexit */
+static void (*volatile thread_exit_hook)(void);
+
+/* Backing store for _sys_alloc and _sys_free (the GlobalAlloc equivalent) */
+static struct sys_heap global_store = { { &global_store.blocks, &global_store.blocks, 0, 0 }, 0 };
+
+/*
+    ===================================================
+                Static helper declarations
+    ===================================================
+*/
+
+extern int _main_init();
+extern void _sys_start(long *sp);
+
+static long sys_call(long n, long a, long b, long c, long d, long e, long f);
+static int set_thread_pointer(struct sys_thread *thread);
+static long clone_thread(long *sp, struct sys_user_desc *tls, volatile int *tid);
+static void thread_start(struct sys_thread *thread);
+static int uring_setup(struct sys_uring *ring);
+static int uring_batch(struct sys_uring *ring, struct _sys_ioreq *req, int n);
+static void *map_pages(unsigned long bytes);
+static void heap_lock(struct sys_heap *heap);
+static void heap_unlock(struct sys_heap *heap);
+static void heap_link(struct sys_heap *heap, struct sys_block *block);
+static void heap_unlink(struct sys_block *block);
+static void *heap_alloc(struct sys_heap *heap, unsigned bytes);
+static void *heap_realloc(struct sys_heap *heap, void *p, unsigned bytes);
+static void heap_free(struct sys_heap *heap, void *p);
+static void set_errno(long rc);
+
+/*
+    ===================================================
+                  Process entry point
+    ===================================================
+*/
+
+/*
+    The kernel enters with argc, argv, and envp laid out on the stack.
+    Hand a pointer to them to _sys_start on a 16 byte aligned stack.
+*/
+__asm__(
+    ".text\n"
+    ".globl _start\n"
+    ".type _start,@function\n"
+    "_start:\n"
+    "    xorl %ebp, %ebp\n"
+    "    movl %esp, %eax\n"
+    "    andl $-16, %esp\n"
+    "    subl $12, %esp\n"
+    "    pushl %eax\n"
+    "    call _sys_start\n"
+    "    hlt\n"
+);
+
+/*
+    @description:
+        Captures the initial process stack and runs the C runtime.
+*/
+void _sys_start(long *sp)
+{
+#define _TLS_SETUP_ERROR 13860
+
+    sys_argc = (int)sp[0];
+    sys_argv = (char**)(sp + 1);
+    sys_envp = sys_argv + sys_argc + 1;
+
+    /* Thread identity (and with it every lock) depends on %gs */
+    if (!set_thread_pointer(&main_thread))
+        _sys_exit(_TLS_SETUP_ERROR);
+
+    _sys_exit(_main_init());
+
+#undef _TLS_SETUP_ERROR
+}
+
+/*
+    ===================================================
+              Public function definitions
+    ===================================================
+*/
+
+/*
+    @description:
+        Retrieves the system standard input handle.
+*/
+_sys_handle_t _sys_stdin(void)
+{
+    return (_sys_handle_t)0;
+}
+
+/*
+    @description:
+        Retrieves the system standard output handle.
+*/
+_sys_handle_t _sys_stdout(void)
+{
+    return (_sys_handle_t)1;
+}
+
+/*
+    @description:
+        Retrieves the system standard error handle.
+*/
+_sys_handle_t _sys_stderr(void)
+{
+    return (_sys_handle_t)2;
+}
+
+/*
+    @description:
+        Retrieves the command line string.
+
+        The kernel hands us a pre-split argv, but the C runtime expects
+        a single command line (see parse_cmdline), so arguments are joined
+        back together and quoted where necessary.
+*/
+char *_sys_commandline(void)
+{
+    if (!sys_cmdline) {
+        unsigned long len = 1;
+        char *it;
+        int i;
+
+        /* Worst case: every character is an escaped quote, plus quotes and a delimiter */
+        for (i = 0; i < sys_argc; ++i)
+            len += 2 * strlen(sys_argv[i]) + 3;
+
+        if (!(sys_cmdline = (char*)_sys_alloc(len)))
+            return "";
+
+        for (it = sys_cmdline, i = 0; i < sys_argc; ++i) {
+            const char *arg = sys_argv[i];
+            int quote = !*arg || strpbrk(arg, " \t\"") != NULL;
+
+            if (i > 0)
+                *it++ = ' ';
+
+            if (quote)
+                *it++ = '"';
+
+            for (; *arg; ++arg) {
+                if (*arg == '"')
+                    *it++ = '\\';
+
+                *it++ = *arg;
+            }
+
+            if (quote)
+                *it++ = '"';
+        }
+
+        *it = '\0';
+    }
+
+    return sys_cmdline;
+}
+
+/*
+    @description:
+        Exit the current process with the specified status.
+*/
+void _sys_exit(int status)
+{
+    for (;;)
+        sys_call(_NR_EXIT_GROUP, status, 0, 0, 0, 0, 0);
+}
+
+/*
+    @description:
+        Retrieves a unique nonzero identifier for the calling thread.
+*/
+unsigned long _sys_thread_self(void)
+{
+    unsigned long self;
+
+    /* The control block address doubles as the identifier, no system call needed */
+    __asm__ ("movl %%gs:0, %0" : "=r"(self));
+
+    return self;
+}
+
+/*
+    @description:
+        Retrieves the library's per-thread pointer for the calling thread, NULL until set.
+*/
+void *_sys_thread_data(void)
+{
+    return ((struct sys_thread*)_sys_thread_self())->data;
+}
+
+/*
+    @description:
+        Sets the library's per-thread pointer for the calling thread.
+*/
+void _sys_thread_setdata(void *data)
+{
+    ((struct sys_thread*)_sys_thread_self())->data = data;
+}
+
+/*
+    @description:
+        Sets the function that a thread made by _sys_thread_create calls
+        once its entry point returns, so the library can release what it
+        keeps per thread. There's one hook for the whole process.
+*/
+void _sys_thread_atexit(void (*fn)(void))
+{
+    thread_exit_hook = fn;
+}
+
+/*
+    @description:
+        Blocks while the value at addr equals value (or until woken).
+*/
+void _sys_wait(volatile int *addr, int value)
+{
+    sys_call(_NR_FUTEX, (long)addr, _LNX_FUTEX_WAIT, value, 0, 0, 0);
+}
+
+/*
+    @description:
+        Wakes up to n threads blocked in _sys_wait on addr.
+*/
+void _sys_wake(volatile int *addr, int n)
+{
+    sys_call(_NR_FUTEX, (long)addr, _LNX_FUTEX_WAKE, n, 0, 0, 0);
+}
+
+/*
+    @description:
+        Starts a thread running fn(arg) and returns a handle for
+        _sys_thread_join, or _SYS_BADHANDLE on failure.
+*/
+_sys_handle_t _sys_thread_create(void (*fn)(void *arg), void *arg)
+{
+    char *map = (char*)map_pages(_THREAD_STACK);
+    struct sys_thread *thread;
+    struct sys_user_desc desc;
+    long *sp;
+
+    if (!map)
+        return _SYS_BADHANDLE;
+
+    /* The control block sits at the top, 16 byte aligned, and the stack grows down from it */
+    thread = (struct sys_thread*)(map + _THREAD_STACK - ((sizeof *thread + 15) & ~15));
+    thread->self = thread;
+    thread->fn = fn;
+    thread->arg = arg;
+    thread->map = map;
+
+    /* The new thread reuses the GDT slot, so its %gs selector needs no reload */
+    desc.entry_number = sys_tls_entry;
+    desc.base_addr = (unsigned long)thread;
+    desc.limit = 0xfffff;
+    desc.flags = _LNX_TLS_FLAGS;
+
+    /* Entry point to pop, then its argument (leaving esp 16 byte aligned at the call) */
+    sp = (long*)thread - 5;
+    sp[0] = (long)thread_start;
+    sp[1] = (long)thread;
+
+    if (_sys_failed(clone_thread(sp, &desc, &thread->tid))) {
+        sys_call(_NR_MUNMAP, (long)map, _THREAD_STACK, 0, 0, 0, 0);
+        return _SYS_BADHANDLE;
+    }
+
+    return thread;
+}
+
+/*
+    @description:
+        Waits for a thread made by _sys_thread_create to finish and
+        releases its resources.
+*/
+void _sys_thread_join(_sys_handle_t handle)
+{
+    struct sys_thread *thread = (struct sys_thread*)handle;
+    int tid;
+
+    /* The kernel zeroes tid and wakes it once the thread is gone (CLONE_CHILD_CLEARTID) */
+    while ((tid = thread->tid) != 0)
+        sys_call(_NR_FUTEX, (long)&thread->tid, _LNX_FUTEX_TID, tid, 0, 0, 0);
+
+    sys_call(_NR_MUNMAP, (long)thread->map, _THREAD_STACK, 0, 0, 0, 0);
+}
+
+/*
+    @description:
+        Gives up the rest of the calling thread's time slice.
+*/
+void _sys_yield(void)
+{
+    sys_call(_NR_SCHED_YIELD, 0, 0, 0, 0, 0, 0);
+}
+
+/*
+    @description:
+        Retrieve the requested environment variable by name.
+*/
+char *_sys_getenv(const char *name)
+{
+    size_t len = strlen(name);
+    char **env;
+
+    for (env = sys_envp; env && *env; ++env) {
+        if (strncmp(*env, name, len) == 0 && (*env)[len] == '=')
+            return *env + len + 1;
+    }
+
+    return 0;
+}
+
+/*
+    @description:
+        Run the command line as a separate process.
+
+        cmd_line is built by system() as the command processor, followed
+        by _SYS_CMDPROCARGS, followed by the command. The shell wants those
+        as separate arguments, so the command is split back out here.
+*/
+int _sys_system(const char *cmd_proc, char *cmd_line)
+{
+    size_t skip = strlen(cmd_proc) + strlen(_SYS_CMDPROCARGS);
+    char *argv[4];
+    long pid, rc;
+    int status;
+
+    argv[0] = (char*)cmd_proc;
+    argv[1] = "-c";
+    argv[2] = strlen(cmd_line) >= skip ? cmd_line + skip : cmd_line;
+    argv[3] = 0;
+
+    /* A plain clone with SIGCHLD as the exit signal is fork */
+    pid = sys_call(_NR_CLONE, _LNX_SIGCHLD, 0, 0, 0, 0, 0);
+
+    if (_sys_failed(pid))
+        return -1;
+
+    if (pid == 0) {
+        /* Child: only returns on failure, 127 is the conventional shell status */
+        sys_call(_NR_EXECVE, (long)cmd_proc, (long)argv, (long)sys_envp, 0, 0, 0);
+        _sys_exit(127);
+    }
+
+    do
+        rc = sys_call(_NR_WAIT4, pid, (long)&status, 0, 0, 0, 0);
+    while (rc == -_LNX_EINTR);
+
+    /* Only a normal exit has a meaningful exit code */
+    if (_sys_failed(rc) || (status & 0x7f) != 0)
+        return -1;
+
+    return (status >> 8) & 0xff;
+}
+
+/*
+    @description:
+        Allocate the specified number of bytes from the global store.
+*/
+void *_sys_alloc(unsigned bytes)
+{
+    return heap_alloc(&global_store, bytes);
+}
+
+/*
+    @description:
+        Free the specified block from the global store.
+        Do nothing if the pointer to the block is NULL.
+*/
+void _sys_free(void *p)
+{
+    heap_free(&global_store, p);
+}
+
+/*
+    @description:
+        Maps zeroed pages for the specified number of bytes starting at a
+        multiple of align, which must be a power of two. Returns NULL on failure.
+*/
+void *_sys_pagealloc(unsigned bytes, unsigned align)
+{
+    unsigned long size = (bytes + _PAGE_SIZE - 1) & ~(_PAGE_SIZE - 1);
+    unsigned long extra = align > _PAGE_SIZE ? align - _PAGE_SIZE : 0;
+    unsigned long base, start;
+
+    if (!(base = (unsigned long)map_pages(size + extra)))
+        return 0;
+
+    /* Trim the over-mapped head and tail so only the aligned run stays */
+    start = (base + extra) & ~(unsigned long)(extra ? align - 1 : 0);
+
+    if (start != base)
+        sys_call(_NR_MUNMAP, (long)base, start - base, 0, 0, 0, 0);
+
+    if (start + size != base + size + extra)
+        sys_call(_NR_MUNMAP, (long)(start + size), base + extra - start, 0, 0, 0, 0);
+
+    return (void*)start;
+}
+
+/*
+    @description:
+        Resizes pages from _sys_pagealloc, letting the kernel move them if they
+        can't grow in place. Returns the new address, a multiple of _SYS_MAPALIGN,
+        or NULL with the pages left untouched.
+*/
+void *_sys_pageremap(void *p, unsigned old, unsigned bytes)
+{
+    unsigned long from = (old + _PAGE_SIZE - 1) & ~(_PAGE_SIZE - 1);
+    unsigned long to = (bytes + _PAGE_SIZE - 1) & ~(_PAGE_SIZE - 1);
+    long moved;
+
+    if (from == to)
+        return p;
+
+    moved = sys_call(_NR_MREMAP, (long)p, from, to, _LNX_MREMAP_MOV, 0, 0);
+
+    return _sys_failed(moved) ? 0 : (void*)moved;
+}
+
+/*
+    @description:
+        Releases pages from _sys_pagealloc. Do nothing if p is NULL.
+*/
+void _sys_pagefree(void *p, unsigned bytes)
+{
+    if (p)
+        sys_call(_NR_MUNMAP, (long)p, (bytes + _PAGE_SIZE - 1) & ~(_PAGE_SIZE - 1), 0, 0, 0, 0);
+}
+
+/*
+    @description:
+        Create a new heap for use with _sys_heapalloc, _sys_heaprealloc, and _sysheapfree.
+*/
+_sys_handle_t _sys_heapcreate()
+{
+    struct sys_heap *heap = (struct sys_heap*)map_pages(sizeof *heap);
+
+    if (heap) {
+        heap->blocks.prev = heap->blocks.next = &heap->blocks;
+        heap->lock = 0;
+    }
+
+    return heap;
+}
+
+/*
+    @description:
+        Destroy and invalidate a heap returned by _sys_heapcreate.
+*/
+void _sys_heapdestroy(_sys_handle_t *heap)
+{
+    struct sys_heap *h = (struct sys_heap*)*heap;
+    struct sys_block *it = h->blocks.next;
+
+    /* Every outstanding block is its own mapping */
+    while (it != &h->blocks) {
+        struct sys_block *next = it->next;
+
+        sys_call(_NR_MUNMAP, (long)it, it->size, 0, 0, 0, 0);
+        it = next;
+    }
+
+    sys_call(_NR_MUNMAP, (long)h, sizeof *h, 0, 0, 0, 0);
+    *heap = _SYS_BADHANDLE;
+}
+
+/*
+    @description:
+        Allocate the specified number of bytes from the specified heap.
+*/
+void *_sys_heapalloc(_sys_handle_t heap, unsigned bytes)
+{
+    return heap_alloc((struct sys_heap*)heap, bytes);
+}
+
+/*
+    @description:
+        Reallocate the specified number of bytes for the block
+        pointed to by p from the specified heap.
+*/
+void *_sys_heaprealloc(_sys_handle_t heap, void *p, unsigned bytes)
+{
+    return heap_realloc((struct sys_heap*)heap, p, bytes);
+}
+
+/*
+    @description:
+        Free the specified block from the specified heap.
+        Do nothing if the pointer to the block is NULL.
+*/
+void _sys_heapfree(_sys_handle_t heap, void *p)
+{
+    heap_free((struct sys_heap*)heap, p);
+}
+
+/*
+    @description:
+        Retrieve a temporary file path.
+
+        Like GetTempPath, the path includes a trailing separator, and
+        the required size is returned if the buffer is too small.
+*/
+int _sys_temppath(char *buf, int n)
+{
+    const char *dir = _sys_getenv("TMPDIR");
+    int len, sep;
+
+    if (!dir || !*dir)
+        dir = "/tmp";
+
+    len = (int)strlen(dir);
+    sep = dir[len - 1] != '/';
+
+    if (len + sep + 1 > n)
+        return len + sep + 1;
+
+    memcpy(buf, dir, len);
+
+    if (sep)
+        buf[len++] = '/';
+
+    buf[len] = '\0';
+
+    return len;
+}
+
+/*
+    @description:
+        Generate a unique filename for the specified path.
+
+        Like GetTempFileName, the file is created to reserve the name,
+        the full path is stored in buf, and the unique number is returned.
+*/
+unsigned _sys_tempfilename(const char* path, const char *prefix, char *buf)
+{
+    static unsigned counter;
+    char name[_TMP_NAME_MAX + 1];
+    size_t len = strlen(path) + strlen(prefix);
+    unsigned unique;
+    int tries;
+
+    /* Room for 8 hex digits and the extension */
+    if (len + 12 > _TMP_NAME_MAX)
+        return 0;
+
+    /* path and buf may overlap, so build the name locally */
+    strcpy(name, path);
+    strcat(name, prefix);
+
+    unique = (unsigned)sys_call(_NR_GETPID, 0, 0, 0, 0, 0, 0) << 16;
+
+    for (tries = 0; tries < 0x10000; ++tries) {
+        unsigned number = unique ^ ++counter;
+        unsigned value = number;
+        long fd;
+        int i;
+
+        /* Zero is the failure value */
+        if (number == 0)
+            continue;
+
+        for (i = 7; i >= 0; --i, value >>= 4)
+            name[len + i] = "0123456789abcdef"[value & 0xf];
+
+        strcpy(name + len + 8, ".tmp");
+
+        fd = sys_call(_NR_OPENAT, _LNX_AT_FDCWD, (long)name,
+            _LNX_O_WRONLY | _LNX_O_CREAT | _LNX_O_EXCL | _LNX_O_CLOEXEC, 0600, 0, 0);
+
+        if (!_sys_failed(fd)) {
+            sys_call(_NR_CLOSE, fd, 0, 0, 0, 0, 0);
+            strcpy(buf, name);
+            return number;
+        }
+        else if (fd != -_LNX_EEXIST) {
+            return 0;
+        }
+    }
+
+    return 0;
+}
+
+/*
+    @description:
+        Convert a mode string into Linux specific open flags.
+*/
+int _sys_parse_openmode(const char *mode, unsigned *flag, int *orient, int *attr, int *share)
+{
+    int exclusive_available = 0;
+    int modes_found = 0;
+
+    /* Text and binary streams are identical, so the text flag is never set */
+
+    /* Sharing is advisory at best on Linux */
+    *share = 0;
+
+    /* Determine the open orientation (read, write, or append) */
+    switch (*mode) {
+    case 'r':
+        *orient = _LNX_O_RDONLY;
+        *attr = 0;
+        break;
+    case 'w':
+        *orient = _LNX_O_WRONLY;
+        *attr = _LNX_O_CREAT | _LNX_O_TRUNC;
+        exclusive_available = 1;
+        break;
+    case 'a':
+        *orient = _LNX_O_WRONLY;
+        *attr = _LNX_O_CREAT | _LNX_O_APPEND;
+        *flag |= 0x0008; /* Writes always go to the end (see stdio.h) */
+        break;
+    default:
+        return 0; /* Invalid mode */
+    }
+
+    /*
+        Determine subsequent attributes for the orientation.
+
+        There are 4 general cases for valid attributes: "+", "+b", "b", "b+". If
+        the initial character is "w", then the mode may end with "x" to specify
+        exclusive access.
+    */
+    while (*++mode && ++modes_found != 4) {
+        switch (*mode) {
+        case '+':
+            *orient = _LNX_O_RDWR;
+            break;
+        case 'b':
+            break;
+        case 'x':
+            /* Ensure that we're in write mode and this is the last attribute */
+            if (!exclusive_available || mode[1])
+                return 0; /* Invalid mode */
+
+            /* Fail if the file already exists */
+            *attr |= _LNX_O_EXCL;
+            break;
+        case 'm':
+            /* Read through a file mapping instead of a buffer (see stdio.h) */
+            *flag |= 0x1000;
+            break;
+        default:
+            return 0; /* Invalid mode */
+        }
+    }
+
+    /* Mappings are read-only */
+    if (*flag & 0x1000 && *orient != _LNX_O_RDONLY)
+        return 0; /* Invalid mode */
+
+    return 1;
+}
+
+/*
+    @description:
+        Attempt to open a file represented by filename with the specified attributes.
+*/
+_sys_handle_t _sys_openfile(const char *filename, int orient, int attr, int share)
+{
+    long fd = sys_call(_NR_OPENAT, _LNX_AT_FDCWD, (long)filename,
+        orient | attr | _LNX_O_LARGE | _LNX_O_CLOEXEC, 0666, 0, 0);
+
+    (void)share;
+
+    if (_sys_failed(fd)) {
+        set_errno(fd);
+        return _SYS_BADHANDLE;
+    }
+
+    return (_sys_handle_t)fd;
+}
+
+/*
+    @description:
+        Close a handle previously opened with _sys_openfile.
+*/
+int _sys_closefile(_sys_handle_t fd)
+{
+    return sys_call(_NR_CLOSE, (long)fd, 0, 0, 0, 0, 0) == 0;
+}
+
+/*
+    @description:
+        Attempt to read n bytes from the specified file into the array pointed to by p.
+*/
+int _sys_read(_sys_handle_t fd, void *p, int n)
+{
+    long rc;
+
+    do
+        rc = sys_call(_NR_READ, (long)fd, (long)p, n, 0, 0, 0);
+    while (rc == -_LNX_EINTR);
+
+    return _sys_failed(rc) ? -1 : (int)rc;
+}
+
+/*
+    @description:
+        Reads into n blocks in order with one system call. Like _sys_read,
+        fewer bytes than requested may be read.
+*/
+int _sys_readv(_sys_handle_t fd, struct _sys_iovec *iov, int n)
+{
+    long rc;
+
+    do
+        rc = sys_call(_NR_READV, (long)fd, (long)iov, n < _IOV_MAX ? n : _IOV_MAX, 0, 0, 0);
+    while (rc == -_LNX_EINTR);
+
+    return _sys_failed(rc) ? -1 : (int)rc;
+}
+
+/*
+    @description:
+        Attempt to write n bytes from the array pointed to by p to the specified file.
+*/
+int _sys_write(_sys_handle_t fd, void *p, int n)
+{
+    int nwritten = 0;
+
+    /* Pipes and terminals may accept less than everything, so keep going */
+    while (nwritten < n) {
+        long rc = sys_call(_NR_WRITE, (long)fd, (long)((char*)p + nwritten), n - nwritten, 0, 0, 0);
+
+        if (rc == -_LNX_EINTR)
+            continue;
+        else if (_sys_failed(rc))
+            return -1;
+
+        nwritten += (int)rc;
+    }
+
+    return nwritten;
+}
+
+/*
+    @description:
+        Writes n blocks to the specified file in one system call where possible.
+        The blocks are consumed as they're written, so iov is modified.
+*/
+int _sys_writev(_sys_handle_t fd, struct _sys_iovec *iov, int n)
+{
+    int nwritten = 0;
+
+    while (n > 0) {
+        long rc = sys_call(_NR_WRITEV, (long)fd, (long)iov, n < _IOV_MAX ? n : _IOV_MAX, 0, 0, 0);
+
+        if (rc == -_LNX_EINTR)
+            continue;
+        else if (_sys_failed(rc))
+            return -1;
+
+        nwritten += (int)rc;
+
+        /* Drop the blocks that went out whole and resume partway into the next */
+        while (n > 0 && (unsigned long)rc >= iov->len) {
+            rc -= iov->len;
+            ++iov;
+            --n;
+        }
+
+        if (n > 0) {
+            iov->base = (char*)iov->base + rc;
+            iov->len -= rc;
+        }
+    }
+
+    return nwritten;
+}
+
+/*
+    @description:
+        Attempt to read n bytes at offset into the array pointed to by p,
+        without using or moving the file position.
+*/
+int _sys_pread(_sys_handle_t fd, void *p, int n, long long offset)
+{
+    long rc;
+
+    do
+        rc = sys_call(_NR_PREAD64, (long)fd, (long)p, n, (long)(offset & 0xffffffff), (long)(offset >> 32), 0);
+    while (rc == -_LNX_EINTR);
+
+    return _sys_failed(rc) ? -1 : (int)rc;
+}
+
+/*
+    @description:
+        Attempt to write n bytes from the array pointed to by p at offset,
+        without using or moving the file position.
+*/
+int _sys_pwrite(_sys_handle_t fd, void *p, int n, long long offset)
+{
+    int nwritten = 0;
+
+    while (nwritten < n) {
+        long rc = sys_call(_NR_PWRITE64, (long)fd, (long)((char*)p + nwritten), n - nwritten,
+                           (long)((offset + nwritten) & 0xffffffff), (long)((offset + nwritten) >> 32), 0);
+
+        if (rc == -_LNX_EINTR)
+            continue;
+        else if (_sys_failed(rc))
+            return -1;
+
+        nwritten += (int)rc;
+    }
+
+    return nwritten;
+}
+
+/*
+    @description:
+        Copies up to n bytes from src to dst without them leaving the
+        kernel, moving both file positions. copy_file_range is tried first
+        and sendfile (which needs only src to be a regular file) second.
+        Returns the number of bytes copied, 0 at end-of-file, or -1 if
+        neither works for this pair of files.
+*/
+int _sys_copy(_sys_handle_t dst, _sys_handle_t src, int n)
+{
+    long rc;
+
+    if (!sys_no_copy_range) {
+        do
+            rc = sys_call(_NR_COPY_RANGE, (long)src, 0, (long)dst, 0, n, 0);
+        while (rc == -_LNX_EINTR);
+
+        if (!_sys_failed(rc))
+            return (int)rc;
+
+        if (rc == -_LNX_ENOSYS)
+            sys_no_copy_range = 1;
+    }
+
+    /* Pipes, sockets, and files on different file systems end up here */
+    do
+        rc = sys_call(_NR_SENDFILE64, (long)dst, (long)src, 0, n, 0, 0);
+    while (rc == -_LNX_EINTR);
+
+    return _sys_failed(rc) ? -1 : (int)rc;
+}
+
+/*
+    @description:
+        Performs n independent reads and writes, each at its file's
+        current position, with as few system calls as possible (one
+        io_uring submission per batch of up to _URING_ENTRIES). Each
+        request gets its own result. Requests in one call should be
+        for different files, since they may complete in any order.
+*/
+int _sys_iobatch(struct _sys_ioreq *req, int n)
+{
+    struct sys_uring *ring = &sys_ring;
+    int i = 0;
+
+    while (__sync_lock_test_and_set(&ring->lock, 1))
+        sys_call(_NR_SCHED_YIELD, 0, 0, 0, 0, 0, 0);
+
+    if (ring->state == 0)
+        ring->state = uring_setup(ring) ? 1 : -1;
+
+    while (ring->state > 0 && i < n) {
+        int count = n - i < _URING_ENTRIES ? n - i : _URING_ENTRIES;
+
+        /* A ring that failed mid-batch may still owe completions, so it's never used again */
+        if (!uring_batch(ring, &req[i], count))
+            ring->state = -1;
+        else
+            i += count;
+    }
+
+    __sync_lock_release(&ring->lock);
+
+    /* Older kernels (or sandboxes) without io_uring just get plain calls */
+    for (; i < n; ++i) {
+        if (req[i].write)
+            req[i].result = _sys_write(req[i].fd, req[i].buf, req[i].len);
+        else
+            req[i].result = _sys_read(req[i].fd, req[i].buf, req[i].len);
+    }
+
+    return n;
+}
+
+/*
+    @description:
+        Retrieve the current file position indicator for the specified file.
+*/
+int _sys_tell(_sys_handle_t fd, long long *pos)
+{
+    long long result = 0;
+    long rc = sys_call(_NR_LLSEEK, (long)fd, 0, 0, (long)&result, 1, 0);
+
+    *pos = result;
+
+    return _sys_failed(rc);
+}
+
+/*
+    @description:
+        Set the current file position indicator for the specified file.
+*/
+int _sys_seek(_sys_handle_t fd, long long offset, int whence)
+{
+    long long result;
+    long rc = sys_call(_NR_LLSEEK, (long)fd, (long)(offset >> 32), (long)(offset & 0xffffffff), (long)&result, whence, 0);
+
+    return _sys_failed(rc);
+}
+
+/*
+    @description:
+        Retrieve the size in bytes of the specified file.
+*/
+int _sys_filesize(_sys_handle_t fd, long long *size)
+{
+    struct sys_stat64 st;
+    long rc = sys_call(_NR_FSTAT64, (long)fd, (long)&st, 0, 0, 0, 0);
+
+    *size = _sys_failed(rc) ? 0 : st.size;
+
+    return _sys_failed(rc);
+}
+
+/*
+    @description:
+        Retrieve the preferred I/O size for the specified file, or 0 if
+        it isn't a regular file (eg. a terminal or pipe).
+*/
+unsigned _sys_blksize(_sys_handle_t fd)
+{
+    struct sys_stat64 st;
+
+    if (_sys_failed(sys_call(_NR_FSTAT64, (long)fd, (long)&st, 0, 0, 0, 0)))
+        return 0;
+
+    return (st.mode & _LNX_S_IFMT) == _LNX_S_IFREG ? st.blksize : 0;
+}
+
+/*
+    @description:
+        Map bytes of the specified file, starting at offset, into memory for reading.
+*/
+void *_sys_map(_sys_handle_t fd, long long offset, unsigned bytes)
+{
+    long p = sys_call(_NR_MMAP2, 0, bytes, _LNX_PROT_READ, _LNX_MAP_SHARED, (long)fd, (long)(offset / _PAGE_SIZE));
+
+    if (_sys_failed(p)) {
+        set_errno(p);
+        return 0;
+    }
+
+    /* Mapped streams are read front to back, so ask for aggressive read-ahead */
+    sys_call(_NR_MADVISE, p, bytes, _LNX_MADV_SEQ, 0, 0, 0);
+
+    return (void*)p;
+}
+
+/*
+    @description:
+        Release a mapping previously created with _sys_map.
+*/
+void _sys_unmap(void *p, unsigned bytes)
+{
+    sys_call(_NR_MUNMAP, (long)p, bytes, 0, 0, 0, 0);
+}
+
+/*
+    @description:
+        Delete the specified file by name.
+*/
+int _sys_unlink(const char *filename)
+{
+    return _sys_failed(sys_call(_NR_UNLINKAT, _LNX_AT_FDCWD, (long)filename, 0, 0, 0, 0));
+}
+
+/*
+    @description:
+        Rename the specified file.
+*/
+int _sys_move(const char *old_name, const char *new_name)
+{
+    return _sys_failed(sys_call(_NR_RENAMEAT, _LNX_AT_FDCWD, (long)old_name, _LNX_AT_FDCWD, (long)new_name, 0, 0));
+}
+
+/*
+    @description:
+        Converts a sequence of multibyte characters to wide characters.
+
+        Multibyte strings are UTF-8 and wide strings are UTF-16, so characters
+        outside of the BMP are stored as surrogate pairs. A negative n converts
+        up to and including the terminating null character.
+*/
+int _sys_mbtowc(wchar_t *wc, const char *s, int n)
+{
+    static const unsigned long min_value[] = { 0, 0x80, 0x800, 0x10000 };
+    const unsigned char *it = (const unsigned char*)s;
+    const unsigned char *end = it + n;
+    int len = 0;
+
+    if (!s)
+        return -1;
+
+    while (n < 0 || it < end) {
+        unsigned long value;
+        int extra, i;
+
+        if (*it < 0x80)                { value = *it;        extra = 0; }
+        else if ((*it & 0xe0) == 0xc0) { value = *it & 0x1f; extra = 1; }
+        else if ((*it & 0xf0) == 0xe0) { value = *it & 0x0f; extra = 2; }
+        else if ((*it & 0xf8) == 0xf0) { value = *it & 0x07; extra = 3; }
+        else {
+            return -1; /* Invalid lead byte */
+        }
+
+        if (n >= 0 && end - it <= extra)
+            return -1; /* Truncated sequence */
+
+        for (i = 1; i <= extra; ++i) {
+            if ((it[i] & 0xc0) != 0x80)
+                return -1; /* Invalid continuation byte */
+
+            value = (value << 6) | (it[i] & 0x3f);
+        }
+
+        /* Reject overlong encodings, encoded surrogates, and values past Unicode */
+        if (value < min_value[extra] || value > 0x10ffff || (value >= 0xd800 && value <= 0xdfff))
+            return -1;
+
+        if (value > 0xffff) {
+            if (wc) {
+                wc[len] = (wchar_t)(0xd800 + ((value - 0x10000) >> 10));
+                wc[len + 1] = (wchar_t)(0xdc00 + ((value - 0x10000) & 0x3ff));
+            }
+
+            len += 2;
+        }
+        else {
+            if (wc)
+                wc[len] = (wchar_t)value;
+
+            ++len;
+        }
+
+        it += extra + 1;
+
+        if (n < 0 && value == 0)
+            break;
+    }
+
+    return len;
+}
+
+/*
+    @description:
+        Converts a sequence of wide characters to multibyte characters.
+
+        See _sys_mbtowc for the encodings used.
+*/
+int _sys_wctomb(char *s, const wchar_t *wc, int n)
+{
+    unsigned char *it = (unsigned char*)s;
+    int i;
+
+    if (!s)
+        return -1;
+
+    if (*wc == L'\0') {
+        *s = '\0';
+        return 1;
+    }
+
+    for (i = 0; n < 0 || i < n; ++i) {
+        unsigned long value = wc[i];
+
+        if (value >= 0xd800 && value <= 0xdbff) {
+            /* A high surrogate must be followed by a low surrogate */
+            if ((n >= 0 && i + 1 >= n) || wc[i + 1] < 0xdc00 || wc[i + 1] > 0xdfff)
+                return -1;
+
+            value = 0x10000 + ((value - 0xd800) << 10) + (wc[++i] - 0xdc00);
+        }
+        else if (value >= 0xdc00 && value <= 0xdfff) {
+            return -1; /* Unpaired low surrogate */
+        }
+
+        if (value < 0x80) {
+            *it++ = (unsigned char)value;
+        }
+        else if (value < 0x800) {
+            *it++ = (unsigned char)(0xc0 | (value >> 6));
+            *it++ = (unsigned char)(0x80 | (value & 0x3f));
+        }
+        else if (value < 0x10000) {
+            *it++ = (unsigned char)(0xe0 | (value >> 12));
+            *it++ = (unsigned char)(0x80 | ((value >> 6) & 0x3f));
+            *it++ = (unsigned char)(0x80 | (value & 0x3f));
+        }
+        else {
+            *it++ = (unsigned char)(0xf0 | (value >> 18));
+            *it++ = (unsigned char)(0x80 | ((value >> 12) & 0x3f));
+            *it++ = (unsigned char)(0x80 | ((value >> 6) & 0x3f));
+            *it++ = (unsigned char)(0x80 | (value & 0x3f));
+        }
+
+        if (n < 0 && value == 0)
+            break;
+    }
+
+    return (int)(it - (unsigned char*)s);
+}
+
+/*
+    @description:
+        Makes a system call on behalf of the other Linux backend files.
+        Failures come back as -errno, as from the kernel.
+*/
+long _sys_linux_call(long n, long a, long b, long c, long d, long e, long f)
+{
+    return sys_call(n, a, b, c, d, e, f);
+}
+
+/*
+    ===================================================
+                Static helper definitions
+    ===================================================
+*/
+
+/*
+    @description:
+        Issues a system call with up to six arguments.
+
+        The sixth argument goes in ebp, which may be the frame pointer,
+        so it's pushed before the stack is touched and loaded from there.
+*/
+long sys_call(long n, long a, long b, long c, long d, long e, long f)
+{
+    long rc;
+
+    __asm__ volatile (
+        "pushl %7\n\t"
+        "pushl %%ebp\n\t"
+        "movl 4(%%esp), %%ebp\n\t"
+        "int $0x80\n\t"
+        "popl %%ebp\n\t"
+        "addl $4, %%esp"
+        : "=a"(rc)
+        : "a"(n), "b"(a), "c"(b), "d"(c), "S"(d), "D"(e), "g"(f)
+        : "memory");
+
+    return rc;
+}
+
+/*
+    @description:
+        Points %gs at the control block of the calling thread.
+*/
+int set_thread_pointer(struct sys_thread *thread)
+{
+    struct sys_user_desc desc;
+
+    thread->self = thread;
+
+    desc.entry_number = (unsigned)-1; /* Let the kernel pick a free TLS slot */
+    desc.base_addr = (unsigned long)thread;
+    desc.limit = 0xfffff;
+    desc.flags = _LNX_TLS_FLAGS;
+
+    if (_sys_failed(sys_call(_NR_SET_TLS, (long)&desc, 0, 0, 0, 0, 0)))
+        return 0;
+
+    sys_tls_entry = desc.entry_number;
+
+    /* Load the selector for the GDT entry: index, GDT table, ring 3 */
+    __asm__ volatile ("movw %w0, %%gs" : : "q"((desc.entry_number << 3) | 3));
+
+    return 1;
+}
+
+/*
+    @description:
+        Issues clone for a new thread on the stack at sp. The child
+        can't return through C code since its stack is brand new, so
+        it pops the entry point left at sp and calls it right away.
+*/
+long clone_thread(long *sp, struct sys_user_desc *tls, volatile int *tid)
+{
+    long rc;
+
+    __asm__ volatile (
+        "int $0x80\n\t"
+        "testl %%eax, %%eax\n\t"
+        "jnz 1f\n\t"
+        "popl %%eax\n\t"
+        "call *%%eax\n\t"
+        "hlt\n"
+        "1:"
+        : "=a"(rc)
+        : "a"(_NR_CLONE), "b"(_LNX_CLONE_THR), "c"(sp), "d"(tid), "S"(tls), "D"(tid)
+        : "memory");
+
+    return rc;
+}
+
+/*
+    @description:
+        Creates the io_uring instance and maps its rings. Returns
+        zero if the kernel doesn't support (or allow) io_uring.
+*/
+int uring_setup(struct sys_uring *ring)
+{
+    struct sys_uring_params params;
+    long fd, sq, cq, sqes;
+
+    memset(&params, 0, sizeof params);
+
+    if (_sys_failed(fd = sys_call(_NR_URING_SETUP, _URING_ENTRIES, (long)&params, 0, 0, 0, 0)))
+        return 0;
+
+    sq = sys_call(_NR_MMAP2, 0, params.sq_off.array + params.sq_entries * sizeof(unsigned),
+                  _LNX_PROT_RW, _LNX_MAP_SHARED, fd, 0);
+    cq = sys_call(_NR_MMAP2, 0, params.cq_off.cqes + params.cq_entries * sizeof(struct sys_uring_cqe),
+                  _LNX_PROT_RW, _LNX_MAP_SHARED, fd, _LNX_URING_CQ);
+    sqes = sys_call(_NR_MMAP2, 0, params.sq_entries * sizeof(struct sys_uring_sqe),
+                    _LNX_PROT_RW, _LNX_MAP_SHARED, fd, _LNX_URING_SQES);
+
+    /* Closing the ring also tears down whatever did get mapped */
+    if (_sys_failed(sq) || _sys_failed(cq) || _sys_failed(sqes)) {
+        sys_call(_NR_CLOSE, fd, 0, 0, 0, 0, 0);
+        return 0;
+    }
+
+    ring->fd = (int)fd;
+    ring->sq_head = (volatile unsigned*)(sq + params.sq_off.head);
+    ring->sq_tail = (volatile unsigned*)(sq + params.sq_off.tail);
+    ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+    ring->sq_mask = *(unsigned*)(sq + params.sq_off.ring_mask);
+    ring->sqes = (struct sys_uring_sqe*)sqes;
+    ring->cq_head = (volatile unsigned*)(cq + params.cq_off.head);
+    ring->cq_tail = (volatile unsigned*)(cq + params.cq_off.tail);
+    ring->cq_mask = *(unsigned*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct sys_uring_cqe*)(cq + params.cq_off.cqes);
+
+    return 1;
+}
+
+/*
+    @description:
+        Queues n (at most _URING_ENTRIES) requests, submits them, and
+        reaps their completions. Returns zero if the ring failed.
+*/
+int uring_batch(struct sys_uring *ring, struct _sys_ioreq *req, int n)
+{
+    unsigned tail = *ring->sq_tail;
+    int submitted = 0;
+    int pending = n;
+    int i;
+
+    for (i = 0; i < n; ++i) {
+        unsigned idx = (tail + i) & ring->sq_mask;
+        struct sys_uring_sqe *sqe = &ring->sqes[idx];
+
+        memset(sqe, 0, sizeof *sqe);
+        sqe->opcode = req[i].write ? _LNX_URING_WRITE : _LNX_URING_READ;
+        sqe->fd = (int)(long)req[i].fd;
+        sqe->off = (unsigned long long)-1; /* Use (and advance) the file position */
+        sqe->addr = (unsigned long)req[i].buf;
+        sqe->len = req[i].len;
+        sqe->user_data = i;
+        ring->sq_array[idx] = idx;
+    }
+
+    /* The entries have to be visible before the kernel can see the new tail */
+    __sync_synchronize();
+    *ring->sq_tail = tail + n;
+
+    for (;;) {
+        unsigned head = *ring->cq_head;
+        unsigned last = *ring->cq_tail;
+        long rc;
+
+        __sync_synchronize();
+
+        /* Reap whatever has completed so far */
+        for (; head != last; ++head) {
+            struct sys_uring_cqe *cqe = &ring->cqes[head & ring->cq_mask];
+
+            req[(int)cqe->user_data].result = cqe->res < 0 ? -1 : cqe->res;
+            --pending;
+        }
+
+        *ring->cq_head = head;
+
+        if (pending == 0)
+            return 1;
+
+        /* Submit anything not yet taken and wait for the rest in the same call */
+        rc = sys_call(_NR_URING_ENTER, ring->fd, n - submitted, pending, _LNX_URING_WAIT, 0, 0);
+
+        if (rc == -_LNX_EINTR)
+            continue;
+        else if (_sys_failed(rc))
+            return 0;
+
+        submitted += (int)rc;
+    }
+}
+
+/*
+    @description:
+        First function of a created thread. Runs the thread's entry point
+        and the exit hook, then ends only the calling thread.
+*/
+void thread_start(struct sys_thread *thread)
+{
+    thread->fn(thread->arg);
+
+    if (thread_exit_hook)
+        thread_exit_hook();
+
+    for (;;)
+        sys_call(_NR_EXIT, 0, 0, 0, 0, 0, 0);
+}
+
+/*
+    @description:
+        Maps zeroed, private pages for at least the specified number of bytes.
+*/
+void *map_pages(unsigned long bytes)
+{
+    long p = sys_call(_NR_MMAP2, 0, bytes, _LNX_PROT_RW, _LNX_MAP_ANON, -1, 0);
+
+    return _sys_failed(p) ? 0 : (void*)p;
+}
+
+/*
+    @description:
+        Acquires the heap lock, yielding the processor while it's contended.
+*/
+void heap_lock(struct sys_heap *heap)
+{
+    while (__sync_lock_test_and_set(&heap->lock, 1))
+        sys_call(_NR_SCHED_YIELD, 0, 0, 0, 0, 0, 0);
+}
+
+/*
+    @description:
+        Releases the heap lock.
+*/
+void heap_unlock(struct sys_heap *heap)
+{
+    __sync_lock_release(&heap->lock);
+}
+
+/*
+    @description:
+        Adds a block to the heap's list of mappings.
+*/
+void heap_link(struct sys_heap *heap, struct sys_block *block)
+{
+    block->prev = &heap->blocks;
+    block->next = heap->blocks.next;
+    block->next->prev = block;
+    heap->blocks.next = block;
+}
+
+/*
+    @description:
+        Removes a block from its heap's list of mappings.
+*/
+void heap_unlink(struct sys_block *block)
+{
+    block->prev->next = block->next;
+    block->next->prev = block->prev;
+}
+
+/*
+    @description:
+        Allocates a block as a dedicated mapping owned by the heap.
+*/
+void *heap_alloc(struct sys_heap *heap, unsigned bytes)
+{
+    unsigned long size = (sizeof(struct sys_block) + bytes + _PAGE_SIZE - 1) & ~(_PAGE_SIZE - 1);
+    struct sys_block *block = (struct sys_block*)map_pages(size);
+
+    if (!block)
+        return 0;
+
+    block->size = size;
+
+    heap_lock(heap);
+    heap_link(heap, block);
+    heap_unlock(heap);
+
+    return block + 1;
+}
+
+/*
+    @description:
+        Resizes a block, letting the kernel move the mapping if it can't grow in place.
+*/
+void *heap_realloc(struct sys_heap *heap, void *p, unsigned bytes)
+{
+    unsigned long size = (sizeof(struct sys_block) + bytes + _PAGE_SIZE - 1) & ~(_PAGE_SIZE - 1);
+    struct sys_block *block;
+    long moved;
+
+    if (!p)
+        return heap_alloc(heap, bytes);
+
+    block = (struct sys_block*)p - 1;
+
+    if (size == block->size)
+        return p;
+
+    heap_lock(heap);
+    heap_unlink(block);
+
+    moved = sys_call(_NR_MREMAP, (long)block, block->size, size, _LNX_MREMAP_MOV, 0, 0);
+
+    if (!_sys_failed(moved)) {
+        block = (struct sys_block*)moved;
+        block->size = size;
+    }
+
+    /* On failure the original block is untouched and goes back in the list */
+    heap_link(heap, block);
+    heap_unlock(heap);
+
+    return _sys_failed(moved) ? 0 : block + 1;
+}
+
+/*
+    @description:
+        Releases a block's mapping back to the system.
+*/
+void heap_free(struct sys_heap *heap, void *p)
+{
+    if (p) {
+        struct sys_block *block = (struct sys_block*)p - 1;
+
+        heap_lock(heap);
+        heap_unlink(block);
+        heap_unlock(heap);
+
+        sys_call(_NR_MUNMAP, (long)block, block->size, 0, 0, 0, 0);
+    }
+}
+
+/*
+    @description:
+        Translates a failed system call result into errno.
+*/
+void set_errno(long rc)
+{
+    switch (-rc) {
+    case _LNX_ENOENT:  errno = ENOENT;   break;
+    case _LNX_ENOTDIR: errno = ENOENT;   break;
+    case _LNX_ENFILE:  errno = ENFILE;   break;
+    case _LNX_EMFILE:  errno = ENFILE;   break;
+    case _LNX_EPERM:   errno = EACCESS;  break;
+    case _LNX_EACCES:  errno = EACCESS;  break;
+    case _LNX_EROFS:   errno = EACCESS;  break;
+    default:           errno = EUNKNOWN; break;
+    }
+}
+
+#endif /* __linux__ */
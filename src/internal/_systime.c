@@ -1,3 +1,5 @@
+#if defined(_WIN32)
+
 #include "_system.h"
 #include "_systime.h"
 #include "_time.h"
@@ -248,4 +250,328 @@ _dsttime_t extract_dst_info(SYSTEMTIME info, int year)
     result.dsec = (_SECS_PER_HOUR * info.wHour) + (_SECS_PER_MINUTE * info.wMinute) + info.wSecond;
 
     return result;
-}
\ No newline at end of file
+}
+
+#elif defined(__linux__)
+
+#include "_system.h"
+#include "_systime.h"
+#include "_time.h"
+#include "ctype.h"
+#include "stdbool.h"
+#include "string.h"
+#include "time.h"
+
+#define _NR_CLOCK_GETTIME 265
+
+#define _LNX_CLOCK_REALTIME  0
+#define _LNX_CLOCK_MONOTONIC 1
+
+/* 
+    ===================================================
+                      Private helpers
+    ===================================================
+*/
+
+/* Kernel timespec for the 32-bit clock_gettime */
+struct sys_timespec {
+    long tv_sec;
+    long tv_nsec;
+};
+
+/* One DST transition of a POSIX TZ rule: the given weekday of the given week of the month */
+typedef struct {
+    int  month; /* 1-12 */
+    int  week;  /* 1-5, where 5 means the last one in the month */
+    int  wday;  /* 0 (Sunday) to 6 */
+    long time;  /* Seconds after midnight, local time in effect before the transition */
+} _dstrule_t;
+
+static char tz_std[16] = "UTC"; /* Standard time zone name */
+static char tz_dst[16];         /* Daylight savings time zone name, empty if there's no DST */
+static long tz_offset;          /* Seconds west of UTC for standard time */
+static long tz_dst_offset;      /* Seconds to add to tz_offset during DST (usually negative) */
+static _dstrule_t tz_begin;     /* Switch to DST */
+static _dstrule_t tz_end;       /* Switch back to standard time */
+static bool tzinfo_init = false;
+
+static void load_tz(void);
+static const char *parse_tzname(const char *s, char *name, size_t size);
+static const char *parse_tzoffset(const char *s, long *offset);
+static const char *parse_tzrule(const char *s, _dstrule_t *rule);
+static long rule_seconds(_dstrule_t rule, int year);
+
+/* 
+    ===================================================
+                    Public definitions
+    ===================================================
+*/
+
+/*
+    @description:
+        Retrieves the process' startup time in clock ticks.
+*/
+long long _sys_getticks(void)
+{
+    struct sys_timespec ts;
+
+    if (_sys_linux_call(_NR_CLOCK_GETTIME, _LNX_CLOCK_MONOTONIC, (long)&ts, 0, 0, 0, 0) != 0)
+        return -1;
+
+    return (long long)ts.tv_sec * CLOCKS_PER_SEC + ts.tv_nsec / (1000000000L / CLOCKS_PER_SEC);
+}
+
+/*
+    @description:
+        Retrieves the number of seconds since 1970, normalized to UTC.
+*/
+long long _sys_getseconds(void)
+{
+    struct sys_timespec ts;
+
+    if (_sys_linux_call(_NR_CLOCK_GETTIME, _LNX_CLOCK_REALTIME, (long)&ts, 0, 0, 0, 0) != 0)
+        return -1;
+
+    return ts.tv_sec;
+}
+
+/*
+    @description:
+        Retrieves the timezone name, dependent on daylight savings time.
+*/
+const char *_sys_timezone_name(void)
+{
+    time_t now = (time_t)_sys_getseconds();
+    struct tm *info;
+
+    load_tz();
+
+    if (!tz_dst[0])
+        return tz_std;
+
+    info = localtime(&now);
+
+    return info && info->tm_isdst > 0 ? tz_dst : tz_std;
+}
+
+/*
+    @description:
+        Retrieves the current timezone bias in seconds.
+*/
+long _sys_timezone_offset(void)
+{
+    load_tz();
+    return tz_offset;
+}
+
+/*
+    @description:
+        Retrieves the current daylight savings time bias.
+*/
+long _sys_dst_offset(void)
+{
+    load_tz();
+    return tz_dst[0] ? tz_dst_offset : 0;
+}
+
+/*
+    @description:
+        Determines whether the given date, in local standard
+        time, is within daylight savings time.
+*/
+int _sys_isdst(struct tm *timeptr)
+{
+    int year = _YEAR_BASE + timeptr->tm_year;
+    long begin, end, now;
+
+    load_tz();
+
+    if (!tz_dst[0])
+        return 0;
+
+    begin = rule_seconds(tz_begin, year);
+
+    /* The end of DST is given in daylight time, but the date being tested is in standard time */
+    end = rule_seconds(tz_end, year) + tz_dst_offset;
+
+    now = timeptr->tm_yday * _SECS_PER_DAY + timeptr->tm_hour * _SECS_PER_HOUR
+        + timeptr->tm_min * _SECS_PER_MINUTE + timeptr->tm_sec;
+
+    /* In the southern hemisphere DST spans the turn of the year */
+    if (begin < end)
+        return now >= begin && now < end;
+    else
+        return now >= begin || now < end;
+}
+
+/* 
+    ===================================================
+                Static helper definitions
+    ===================================================
+*/
+
+/*
+    @description:
+        Parses the POSIX TZ environment variable once, e.g. "EST5EDT" or
+        "CET-1CEST,M3.5.0,M10.5.0/3". There's no time zone database, so
+        anything else (including an unset TZ) is treated as UTC.
+*/
+void load_tz(void)
+{
+    /* Assume standard USA daylight savings time rules if TZ doesn't give any */
+    _dstrule_t us_begin = { 3, 2, 0, 2 * _SECS_PER_HOUR };  /* 2nd Sunday of Mar at 02:00 */
+    _dstrule_t us_end = { 11, 1, 0, 2 * _SECS_PER_HOUR };   /* 1st Sunday of Nov at 02:00 */
+    const char *s = _sys_getenv("TZ");
+    char std[sizeof tz_std], dst[sizeof tz_dst];
+    long offset, dst_offset;
+
+    if (tzinfo_init)
+        return;
+
+    tzinfo_init = true;
+
+    if (!s || !(s = parse_tzname(s, std, sizeof std)) || !(s = parse_tzoffset(s, &offset)))
+        return;
+
+    dst[0] = '\0';
+    dst_offset = offset - _SECS_PER_HOUR;
+
+    if (*s && (s = parse_tzname(s, dst, sizeof dst)) != NULL) {
+        if (*s && *s != ',')
+            s = parse_tzoffset(s, &dst_offset);
+
+        if (s && *s == ',') {
+            if (!(s = parse_tzrule(s + 1, &us_begin)) || *s != ',' || !(s = parse_tzrule(s + 1, &us_end)))
+                return;
+        }
+    }
+
+    if (!s || *s)
+        return;
+
+    strcpy(tz_std, std);
+    strcpy(tz_dst, dst);
+    tz_offset = offset;
+    tz_dst_offset = dst_offset - offset;
+    tz_begin = us_begin;
+    tz_end = us_end;
+}
+
+/*
+    @description:
+        Parses a TZ zone name, either alphabetic or quoted with <>.
+        Returns the end of the name, or NULL if it isn't valid.
+*/
+const char *parse_tzname(const char *s, char *name, size_t size)
+{
+    char close = '\0';
+    size_t n = 0;
+
+    if (*s == '<')
+        close = *s++;
+
+    while (close ? *s && *s != '>' : isalpha((unsigned char)*s)) {
+        if (n + 1 == size)
+            return NULL;
+
+        name[n++] = *s++;
+    }
+
+    name[n] = '\0';
+
+    /* POSIX requires at least three characters */
+    if (n < 3 || (close && *s++ != '>'))
+        return NULL;
+
+    return s;
+}
+
+/*
+    @description:
+        Parses a TZ offset of the form [+-]hh[:mm[:ss]] (positive is west of
+        Greenwich). Returns the end of the offset, or NULL if it isn't valid.
+*/
+const char *parse_tzoffset(const char *s, long *offset)
+{
+    long unit = _SECS_PER_HOUR;
+    int sign = 1;
+
+    if (*s == '+' || *s == '-')
+        sign = *s++ == '-' ? -1 : 1;
+
+    if (!isdigit((unsigned char)*s))
+        return NULL;
+
+    for (*offset = 0; unit && isdigit((unsigned char)*s); unit /= 60) {
+        long part = 0;
+
+        while (isdigit((unsigned char)*s))
+            part = part * 10 + (*s++ - '0');
+
+        *offset += part * unit;
+
+        if (*s != ':' || unit == 1)
+            break;
+
+        ++s;
+    }
+
+    *offset *= sign;
+
+    return s;
+}
+
+/*
+    @description:
+        Parses a TZ transition rule of the form Mm.w.d[/time]. The Julian
+        day forms aren't supported. Returns the end of the rule, or NULL.
+*/
+const char *parse_tzrule(const char *s, _dstrule_t *rule)
+{
+    int *field[3];
+    int i;
+
+    field[0] = &rule->month;
+    field[1] = &rule->week;
+    field[2] = &rule->wday;
+
+    if (*s++ != 'M')
+        return NULL;
+
+    for (i = 0; i < 3; ++i) {
+        if (!isdigit((unsigned char)*s))
+            return NULL;
+
+        for (*field[i] = 0; isdigit((unsigned char)*s); ++s)
+            *field[i] = *field[i] * 10 + (*s - '0');
+
+        if (i < 2 && *s++ != '.')
+            return NULL;
+    }
+
+    if (rule->month < 1 || rule->month > 12 || rule->week < 1 || rule->week > 5 || rule->wday > 6)
+        return NULL;
+
+    rule->time = 2 * _SECS_PER_HOUR;
+
+    return *s == '/' ? parse_tzoffset(s + 1, &rule->time) : s;
+}
+
+/*
+    @description:
+        Calculates the transition time of a rule in the given
+        year as seconds from the start of the year.
+*/
+long rule_seconds(_dstrule_t rule, int year)
+{
+    int leap = _LEAP_YEAR(year);
+    int mday = 1 + (rule.wday - _first_wday(year, rule.month) + 7) % 7 + (rule.week - 1) * 7;
+
+    /* Week 5 means the last such weekday, which may be in the 4th week */
+    if (mday > monthdays[leap][rule.month - 1])
+        mday -= 7;
+
+    return (yeardays[leap][rule.month - 1] + mday) * _SECS_PER_DAY + rule.time;
+}
+
+#endif /* __linux__ */
\ No newline at end of file
@@ -91,6 +91,8 @@ char *setlocale(int category, const char *locale)
 
         if (!locale)
             return NULL;
+
+        is_default = strcmp(locale, "C") == 0;
     }
 
     if (!(loc = (_locale*)malloc(sizeof *loc)))
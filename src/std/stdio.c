@@ -1,21 +1,136 @@
+#include "_lock.h"
+#include "_memscan.h"
 #include "_system.h"
-#include "_deque.h"
 #include "_printf.h"
 #include "_scanf.h"
 #include "errno.h"
 #include "stdarg.h"
 #include "stdbool.h"
 #include "stdio.h"
+#include "stdlib.h"
 #include "string.h"
 
 FILE __io_buf[FOPEN_MAX];      /* Regular files opened with fopen (and standard streams) */
 FILE __io_tmp[TMP_MAX];        /* Files opened for temporary use (ie. tmpfile) */
+FILE *__io_open;               /* All open streams, most recently opened first */
 
 char __tmp_name[L_tmpnam];     /* Runtime owned temporary file name */
 char __stdin_buf[BUFSIZ];      /* Main input buffer for stdin */
-char __stdin_unget[_UNGETSIZ]; /* Unget buffer for stdin */
 char __stdout_buf[BUFSIZ];     /* Main output buffer for stdout */
-char __stderr_buf[1];          /* "Buffer" for stderr for simplicity */
+char __stderr_buf[_MINBUFSIZ]; /* "Buffer" for stderr for simplicity */
+
+#define _TMPSPILL 0x10000      /* Default size past which tmpfile data moves to disk */
+
+static size_t default_bufsiz;  /* Buffer size for new streams (0 means automatic) */
+static size_t tmp_spill = _TMPSPILL; /* Size past which tmpfile data moves to disk (0 means always on disk) */
+
+struct file_pool {
+    FILE  *slots; /* Backing array of the pool */
+    size_t limit; /* Number of slots in the array */
+    size_t used;  /* High-water mark; slots past it have never been handed out */
+    FILE  *free;  /* Released slots, linked through next */
+};
+
+/* stdin, stdout, and stderr are already taken (see init_stdio) */
+static struct file_pool io_pool = { __io_buf, FOPEN_MAX, 3, NULL };
+static struct file_pool tmp_pool = { __io_tmp, TMP_MAX, 0, NULL };
+
+static struct _lock io_lock;   /* Guards the pools and the open stream list */
+
+#define _LOGSEGS  4    /* Segments in the ring of a log stream */
+#define _LOGRECSIZ 512 /* Records formatted by vfprintf that fit on the stack */
+#define _IOVLOCAL  16  /* Blocks of a vectored transfer that fit on the stack */
+#define _FILLBATCH 64  /* Streams refilled per _sys_iobatch call by _ffill */
+#define _PCACHESIZ BUFSIZ /* Window of the file kept by _fpread */
+#define _LINESIZ   128 /* Smallest buffer getdelim allocates */
+#define _MEMSIZ    64  /* Starting capacity of an open_memstream buffer */
+#define _COPYSIZ   0x10000    /* Block size when _fcopy has to go through memory */
+#define _COPYMAX   0x40000000 /* Most _fcopy asks the system to copy at once */
+
+/* Streams whose system file position moves in ways that can't be tracked */
+#define _UNTRACKED (_APPEND | _LOG | _ASYNC)
+
+/* Streams with no system handle behind them */
+#define _NOHANDLE (_MEM | _COOKIE)
+
+/* The last window of the file fetched by a small positional read */
+struct _pcache {
+    fpos_t off;              /* File offset of buf[0] */
+    size_t len;              /* Valid bytes in buf (0 when empty) */
+    char   buf[_PCACHESIZ];
+};
+
+/*
+    A memory stream is buffered like any other, but its "file" is a block
+    of memory. It's either fixed (fmemopen), where writes stop at the end,
+    or grown with realloc, and then either published to the caller
+    (open_memstream) or moved to a real file once it's big (tmpfile).
+*/
+struct _mem {
+    char   *buf;     /* The memory being read and written */
+    size_t  size;    /* Capacity of buf */
+    size_t  len;     /* Bytes of data in buf */
+    bool    read;    /* Reads are allowed */
+    bool    write;   /* Writes are allowed */
+    bool    append;  /* Writes always go to the end of the data */
+    bool    grow;    /* buf is reallocated as needed instead of stopping writes */
+    bool    owned;   /* buf was allocated with malloc and goes with the stream */
+    size_t  spill;   /* Data size that moves the stream to a temporary file (0 if never) */
+    char  **ptr;     /* Where open_memstream publishes buf (NULL if unpublished) */
+    size_t *sizeloc; /* Where open_memstream publishes the size */
+};
+
+/* The callbacks and access of a custom stream */
+struct _cookie {
+    void        *cookie; /* Passed to every callback */
+    _cookie_io_t io;
+    bool         read;   /* Reads are allowed */
+    bool         write;  /* Writes are allowed */
+};
+
+#define _ASYNC_IDLE   0 /* Nothing posted */
+#define _ASYNC_POSTED 1 /* A transfer is waiting for (or running on) the worker */
+#define _ASYNC_DONE   2 /* The transfer finished and its result is ready */
+#define _ASYNC_EXIT   3 /* The worker should stop */
+
+/*
+    An async stream has a second buffer of the same size. While the caller
+    works in one, a worker thread reads ahead into or writes behind from
+    the other, and the two trade places when the caller's runs out (or
+    fills up). Only one transfer is ever in flight.
+*/
+struct _async {
+    _sys_handle_t fd;     /* Same as the stream's */
+    _sys_handle_t worker; /* Thread doing the transfers */
+    volatile int  state;  /* _ASYNC_IDLE, _ASYNC_POSTED, _ASYNC_DONE, or _ASYNC_EXIT */
+    bool          write;  /* The transfer writes buf rather than reading into it */
+    char         *buf;    /* Block being transferred */
+    int           len;    /* Length of the block */
+    volatile int  result; /* Bytes transferred, or -1 on error */
+    bool          ready;  /* A finished read-ahead is waiting in spare */
+    char         *spare;  /* The buffer not currently in the stream's hands */
+    char         *home;   /* The stream's own buffer, handed back when the worker stops */
+};
+
+/*
+    A log stream's buffer is split into a ring of segments. Writers reserve
+    room for a whole record in the current segment with one atomic add and
+    copy it in without taking the stream lock. The writer whose reservation
+    runs off the end seals the segment and moves everyone on to the next,
+    and whoever holds the stream lock writes out every sealed segment with
+    one vectored write.
+*/
+struct _log {
+    volatile unsigned head; /* Sequence number of the segment being filled */
+    volatile unsigned tail; /* Sequence number of the oldest unwritten segment */
+    size_t            span; /* Capacity of each segment */
+    struct {
+        volatile unsigned used;   /* Bytes reserved (past span once sealed) */
+        volatile unsigned done;   /* Bytes copied in by finished writers */
+        volatile unsigned sealed; /* Final length, set by the sealing writer */
+        volatile unsigned seq;    /* Sequence number the segment is being filled for */
+    } seg[_LOGSEGS];
+};
 
 /* 
     ===================================================
@@ -24,17 +139,59 @@ char __stderr_buf[1];          /* "Buffer" for stderr for simplicity */
 */
 
 static char *get_temp_name(char *buf);
-static FILE *get_unused_handle(FILE handles[], size_t limit);
+static FILE *get_unused_handle(struct file_pool *pool);
+static void release_handle(FILE *stream);
+static void link_stream(FILE *stream);
+static void unlink_stream(FILE *stream);
+static int close_stream(FILE *stream);
+static int ungetc_unlocked(int c, FILE *in);
 static FILE *file_open(FILE *file, const char * restrict filename, const char * restrict mode, bool tempfile);
-static size_t count_newline_diff(struct _deque *buf, bool as_stack);
+static size_t get_default_bufsiz(void);
+static size_t bound_bufsiz(size_t size);
 static size_t count_buffer_bytes(FILE *stream);
+static size_t read_buffered(FILE *in, char *dst, size_t n);
+static size_t read_line(FILE *in, int delim, char *dst, size_t n, bool *found);
+static size_t write_buffered(FILE *out, const char *src, size_t n);
+static size_t read_vector(FILE *in, const struct _sys_iovec *iov, int n);
+static size_t write_vector(FILE *out, const struct _sys_iovec *iov, int n, size_t bytes);
+static size_t copy_stream(FILE *dst, FILE *src, size_t n);
 static bool intern_tell(FILE *stream, fpos_t *new_pos);
 static bool intern_seek(FILE *stream, fpos_t offset, int whence);
 static int peekbuf(FILE *in);
 static bool fillbuf(FILE *in);
 static bool flushbuf(FILE *out);
+static void growbuf(FILE *stream);
+static bool mapbuf(FILE *in);
+static void unmapbuf(FILE *stream);
 static size_t compact_newlines(FILE *in, char *buf, size_t n);
-static size_t expand_newlines(FILE *out, char *output);
+static size_t expand_newlines(FILE *out, const char *src, size_t n);
+static struct _log *log_start(size_t size);
+static bool log_append(FILE *out, const struct _sys_iovec *rec, int n);
+static int log_printf(FILE *out, const char *fmt, va_list args);
+static bool log_seal(FILE *out, unsigned slot, unsigned off);
+static bool log_flush(FILE *out);
+static bool log_drain(FILE *out);
+static void log_yield(FILE *out);
+static void copy_record(char *dst, const struct _sys_iovec *rec, int n, bool text);
+static bool syncbuf(FILE *out);
+static bool pcache_fill(FILE *in, fpos_t pos, size_t want);
+static void pcache_drop(FILE *stream);
+static struct _async *async_start(FILE *stream, size_t size);
+static bool async_fill(FILE *in);
+static bool async_flush(FILE *out);
+static void async_post(FILE *stream, bool write, char *buf, int len);
+static bool async_settle(FILE *stream);
+static void async_stop(FILE *stream);
+static void async_worker(void *arg);
+static int device_read(FILE *in, void *dst, int n);
+static int device_write(FILE *out, const void *src, int n);
+static bool device_seek(FILE *stream, fpos_t offset, int whence);
+static FILE *device_open(struct file_pool *pool, unsigned kind, const void *init, size_t size, fpos_t pos);
+static bool parse_access(const char *mode, bool *read, bool *write, bool *append);
+static bool mem_reserve(struct _mem *mem, size_t need);
+static bool mem_seek(FILE *stream, fpos_t offset, int whence);
+static bool mem_spill(FILE *stream);
+static bool ensure_handle(FILE *stream);
 static int write_stream(void *data, void *dst, size_t n, size_t *count, size_t limit);
 static int write_string(void *data, void *dst, size_t n, size_t *count, size_t limit);
 static int write_nothing(void *data, void *dst, size_t n, size_t *count, size_t limit);
@@ -75,12 +232,30 @@ int rename(const char *old_name, const char *new_name)
         Creates a temporary binary file that is different
         from any other existing file and that will automatically
         be removed when it is closed or at program termination.
+
+        The file starts out in memory, and only becomes a real
+        file once it holds more than the spill size (see _settmpspill).
 */
 FILE *tmpfile(void)
 {
     char buf[L_tmpnam];
     FILE *fp = NULL;
 
+    if (tmp_spill) {
+        struct _mem mem;
+
+        memset(&mem, 0, sizeof mem);
+        mem.read = mem.write = mem.grow = mem.owned = true;
+        mem.spill = tmp_spill;
+
+        if (mem_reserve(&mem, 0)) {
+            if ((fp = device_open(&tmp_pool, _MEM, &mem, sizeof mem, 0)) != NULL)
+                return fp;
+
+            free(mem.buf);
+        }
+    }
+
     if (get_temp_name(buf))
         fp = file_open(NULL, buf, "rb+", true);
 
@@ -121,7 +296,7 @@ FILE *freopen(const char * restrict filename, const char * restrict mode, FILE *
         chooses to support none. ;)  -JRD
     */
     if (filename) {
-        fclose(stream); /* It's required to ignore close errors */
+        close_stream(stream); /* It's required to ignore close errors */
         stream = file_open(stream, filename, mode, false);
     }
 
@@ -130,39 +305,128 @@ FILE *freopen(const char * restrict filename, const char * restrict mode, FILE *
 
 /*
     @description:
-        Causes the stream pointed to by stream to be flushed
-        and the associated file to be closed.
+        Opens a stream on the size bytes of memory pointed to by buf,
+        with the same modes as fopen. Reads stop at the end of the data,
+        writes at the end of the memory. Without buf, the stream allocates
+        its own memory, which is freed when the stream is closed.
 */
-int fclose(FILE *stream)
+FILE *fmemopen(void * restrict buf, size_t size, const char * restrict mode)
 {
-    int rc = 0;
-
-    if (stream->flag & _OPEN) {
-        /* Try to flush if the stream is in write mode */
-        if (stream->flag & _WRITE && !flushbuf(stream))
-            rc = EOF;
+    struct _mem mem;
+    FILE *stream;
 
-        /* Try to close the underlying handle */
-        if (!_sys_closefile(stream->fd))
-            rc = EOF;
+    memset(&mem, 0, sizeof mem);
 
-        /* Release owned main buffer memory */
-        if (stream->flag & _OWNED)
-            _sys_free(stream->buf.base);
+    if (!parse_access(mode, &mem.read, &mem.write, &mem.append) || size == 0) {
+        errno = EINVAL;
+        return NULL;
+    }
 
-        /* unget is always owned, but may not be dynamically allocated */
-        if (stream->flag & _ALLOC)
-            _sys_free(stream->unget.base);
+    mem.size = size;
 
-        if (stream->flag & _TEMP) {
-            remove(stream->tmp);    /* Temporary files are always deleted */
-            _sys_free(stream->tmp); /* Don't forget we allocated the filename */
+    if (!(mem.buf = (char*)buf)) {
+        if (!(mem.buf = (char*)malloc(size))) {
+            errno = ENOMEM;
+            return NULL;
         }
 
-        /* Mark the stream as unused */
-        stream->flag = 0;
+        mem.buf[0] = '\0';
+        mem.owned = true;
+    }
+
+    /* Reads see the whole buffer, writes start it over, and appends start at the first null character */
+    if (*mode == 'w')
+        mem.buf[0] = '\0';
+    else if (*mode == 'r' && !mem.owned)
+        mem.len = size;
+    else
+        mem.len = _memscan(mem.buf, '\0', size);
+
+    if (!(stream = device_open(&io_pool, _MEM, &mem, sizeof mem, mem.append ? (fpos_t)mem.len : 0)) && mem.owned)
+        free(mem.buf);
+
+    return stream;
+}
+
+/*
+    @description:
+        Opens a stream for writing to a growing block of memory. On every
+        fflush and on fclose, *ptr points to the memory and *sizeloc holds
+        the number of bytes up to the file position. The data is always
+        followed by a null character, and the caller frees the memory.
+*/
+FILE *open_memstream(char **ptr, size_t *sizeloc)
+{
+    struct _mem mem;
+    FILE *stream;
+
+    if (!ptr || !sizeloc) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    memset(&mem, 0, sizeof mem);
+    mem.write = mem.grow = true;
+
+    /* The caller frees the memory, so it has to come from malloc */
+    if (!mem_reserve(&mem, 0)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    mem.buf[0] = '\0';
+    mem.ptr = ptr;
+    mem.sizeloc = sizeloc;
+
+    if (!(stream = device_open(&io_pool, _MEM, &mem, sizeof mem, 0))) {
+        free(mem.buf);
+        return NULL;
+    }
+
+    *ptr = mem.buf;
+    *sizeloc = 0;
+
+    return stream;
+}
+
+/*
+    @description:
+        Opens a stream whose reads, writes, seeks and closing are done
+        by the functions in io, each called with cookie. The stream is
+        buffered like any other. The mode is the same as for fopen,
+        except that there's no text translation and appending is up to
+        the callbacks.
+*/
+FILE *_fopencookie(void * restrict cookie, const char * restrict mode, _cookie_io_t io)
+{
+    struct _cookie dev;
+    bool append;
+
+    if (!parse_access(mode, &dev.read, &dev.write, &append)) {
+        errno = EINVAL;
+        return NULL;
     }
 
+    dev.cookie = cookie;
+    dev.io = io;
+
+    return device_open(&io_pool, _COOKIE, &dev, sizeof dev, 0);
+}
+
+/*
+    @description:
+        Causes the stream pointed to by stream to be flushed
+        and the associated file to be closed.
+*/
+int fclose(FILE *stream)
+{
+    bool open = (stream->flag & _OPEN) != 0;
+    int rc = close_stream(stream);
+
+    /* The slot can be handed out again */
+    if (open)
+        release_handle(stream);
+
     return rc;
 }
 
@@ -173,7 +437,7 @@ int fclose(FILE *stream)
 */
 void setbuf(FILE * restrict stream, char * restrict buf)
 {
-    setvbuf(stream, buf, (buf ? _IOFBF : _IONBF), (buf ? BUFSIZ : 1));
+    setvbuf(stream, buf, (buf ? _IOFBF : _IONBF), (buf ? BUFSIZ : _MINBUFSIZ));
 }
 
 /*
@@ -183,34 +447,112 @@ void setbuf(FILE * restrict stream, char * restrict buf)
         the unowned buffer with the size of the array denoted
         by size. If buf is a null pointer, size will be used 
         to create an owned buffer.
+
+        _IOLOG (an extension) makes a write-only stream where every
+        write call is one record that's never split or interleaved
+        with records from other threads, and writers don't lock.
+
+        _IOASYNC (an extension) is full buffering with a second buffer
+        of the same size, which a worker thread reads ahead into or
+        writes behind from while the caller uses the first. fflush
+        waits for the write in flight.
 */
 int setvbuf(FILE * restrict stream, char * restrict buf, int mode, size_t size)
 {
     bool owned = (buf == NULL);
+    struct _log *log = NULL;
+    struct _async *async = NULL;
 
     /* Without a size, all kinds of gremlins can pop up */
     if (size == 0)
         return -1;
 
+    /* Mapped streams read through their mapping and never buffer */
+    if (stream->flag & _MAP)
+        return -1;
+
+    /* Text streams buffer expanded newlines, which must fit in one piece */
+    if (stream->flag & _TEXT && size < _MINBUFSIZ) {
+        if (!owned)
+            return -1;
+
+        size = _MINBUFSIZ;
+    }
+
+    /* Every segment of a log ring needs room for at least a CRLF */
+    if (mode == _IOLOG && size < _LOGSEGS * _MINBUFSIZ)
+        return -1;
+
+    /* Trading whole buffers leaves nowhere to finish compacting a split CRLF */
+    if (mode == _IOASYNC && stream->flag & _TEXT)
+        return -1;
+
+    /* The log drain and the worker both need a system handle, which an in-memory tmpfile gets now */
+    if (mode == _IOLOG || mode == _IOASYNC) {
+        bool handle;
+
+        flockfile(stream);
+        handle = ensure_handle(stream);
+        funlockfile(stream);
+
+        if (!handle)
+            return -1;
+    }
+
     if (owned) {
         /* Try to make an owned buffer */
         if (!(buf = (char*)_sys_alloc(size)))
             return -1;
     }
 
+    if ((mode == _IOLOG && !(log = log_start(size))) || (mode == _IOASYNC && !(async = async_start(stream, size)))) {
+        if (owned)
+            _sys_free(buf);
+
+        return -1;
+    }
+
+    flockfile(stream);
+
+    /* Nothing can be in flight while the buffers change hands */
+    if (stream->flag & _ASYNC)
+        async_stop(stream);
+
+    /* Records still in the old ring go out before it disappears */
+    if (stream->flag & _LOG) {
+        log_flush(stream);
+        _sys_free(stream->log);
+    }
+
     /* With a valid buf, the old buffer can be safely freed */
     if (stream->flag & _OWNED)
-        _sys_free(stream->buf.base);
+        _sys_free(stream->base);
 
     /* Make sure the owned state is properly set */
     stream->flag = owned ? (stream->flag | _OWNED) : (stream->flag & ~_OWNED);
 
-    /* Set the new buffering flag */
-    stream->flag &= ~(_LBF | _NBF);
+    /* Set the new buffering flag (an explicit size is never grown) */
+    stream->flag &= ~(_LBF | _NBF | _GROW | _LOG | _ASYNC);
     stream->flag |= mode;
 
-    /* Finally, apply the new buffer */
-    _deque_init(stream->buf, buf, size);
+    if (stream->flag & _UNTRACKED)
+        stream->flag &= ~_POS;
+
+    /* Log streams only ever write, so they stay in write mode */
+    if ((stream->log = log) != NULL) {
+        stream->flag &= ~_READ;
+        stream->flag |= _WRITE;
+    }
+
+    /* Finally, apply the new (empty) buffer */
+    stream->base = stream->begin = stream->end = buf;
+    stream->mark = NULL;
+    stream->size = size;
+
+    if ((stream->async = async) != NULL)
+        async->home = buf;
+
+    funlockfile(stream);
 
     return 0;
 }
@@ -225,7 +567,13 @@ int setvbuf(FILE * restrict stream, char * restrict buf, int mode, size_t size)
 */
 int fsetpos(FILE *stream, const fpos_t *pos)
 {
-    return intern_seek(stream, *pos, SEEK_SET);
+    int rc;
+
+    flockfile(stream);
+    rc = intern_seek(stream, *pos, SEEK_SET) ? 0 : -1;
+    funlockfile(stream);
+
+    return rc;
 }
 
 /*
@@ -236,7 +584,13 @@ int fsetpos(FILE *stream, const fpos_t *pos)
 */
 int fgetpos(FILE * restrict stream, fpos_t * restrict pos)
 {
-    return intern_tell(stream, pos);
+    int rc;
+
+    flockfile(stream);
+    rc = intern_tell(stream, pos) ? 0 : -1;
+    funlockfile(stream);
+
+    return rc;
 }
 
 /*
@@ -247,8 +601,13 @@ int fgetpos(FILE * restrict stream, fpos_t * restrict pos)
 long ftell(FILE *stream)
 {
     fpos_t pos;
+    long rc;
+
+    flockfile(stream);
+    rc = intern_tell(stream, &pos) ? (long)pos : -1L;
+    funlockfile(stream);
 
-    return intern_tell(stream, &pos) ? -1L : (long)pos;
+    return rc;
 }
 
 /*
@@ -259,11 +618,17 @@ long ftell(FILE *stream)
 */
 int fseek(FILE *stream, long offset, int whence)
 {
+    int rc;
+
     /*
         intern_seek uses fpos_t, but that's alright because long
         is a subset of long long. Everything works out correctly.
     */
-    return intern_seek(stream, offset, whence);
+    flockfile(stream);
+    rc = intern_seek(stream, offset, whence) ? 0 : -1;
+    funlockfile(stream);
+
+    return rc;
 }
 
 /*
@@ -281,6 +646,21 @@ void rewind(FILE *stream)
         Reads the next character from the stream pointed to by in, if available.
 */
 int fgetc(FILE *in)
+{
+    int c;
+
+    flockfile(in);
+    c = fgetc_unlocked(in);
+    funlockfile(in);
+
+    return c;
+}
+
+/*
+    @description:
+        Equivalent to fgetc, except that the caller is responsible for locking.
+*/
+int fgetc_unlocked(FILE *in)
 {
     /* The stream must be both open and in read mode */
     if (!(in->flag & _OPEN) || in->flag & _WRITE)
@@ -290,16 +670,16 @@ int fgetc(FILE *in)
     in->flag &= ~_WRITE;
     in->flag |= _READ;
 
-    if (_deque_ready(in->unget) && !_deque_empty(in->unget)) {
+    if (in->nunget > 0) {
         /* Pull from a non-empty unget buffer */
-        return _deque_popf(in->unget);
+        return (unsigned char)in->unget[--in->nunget];
     }
     else {
         /* Pull from the main buffer (refill if necessary) */
-        if ((in->flag & _NBF || _deque_empty(in->buf)) && !fillbuf(in))
+        if (in->begin == in->end && !fillbuf(in))
             return EOF;
 
-        return _deque_popb(in->buf);
+        return (unsigned char)*in->begin++;
     }
 }
 
@@ -310,22 +690,61 @@ int fgetc(FILE *in)
 */
 int fputc(int c, FILE *out)
 {
-    /* The stream must be both open and in write mode */
-    if (!(out->flag & _OPEN) || out->flag & _READ)
+    /* Log streams don't lock */
+    if (out->flag & _LOG)
+        return fputc_unlocked(c, out);
+
+    flockfile(out);
+    c = fputc_unlocked(c, out);
+    funlockfile(out);
+
+    return c;
+}
+
+/*
+    @description:
+        Equivalent to fputc, except that the caller is responsible for locking.
+*/
+int fputc_unlocked(int c, FILE *out)
+{
+    /* The stream must be both open and in write mode (the mapping is read-only) */
+    if (!(out->flag & _OPEN) || out->flag & (_READ | _MAP))
         return EOF;
 
+    if (out->flag & _LOG) {
+        struct _sys_iovec rec;
+        char ch = (char)c;
+
+        rec.base = &ch;
+        rec.len = 1;
+
+        return log_append(out, &rec, 1) ? (unsigned char)ch : EOF;
+    }
+
     /* Reset the stream to write mode */
     out->flag &= ~_READ;
     out->flag |= _WRITE;
 
-    _deque_pushf(out->buf, (char)c);
+    /* Text streams buffer the device's line break, so make room for both halves */
+    if (out->flag & _TEXT && (char)c == '\n') {
+        if (out->base + out->size - out->end < 2 && !flushbuf(out))
+            return EOF;
+
+        *out->end++ = '\r';
+    }
+    else if (out->end == out->base + out->size && !flushbuf(out)) {
+        /* putc_unlocked may have filled the last slot without flushing */
+        return EOF;
+    }
+
+    *out->end++ = (char)c;
 
     /*
         1) Flush on a newline.
         2) Always flush if buffering is turned off.
         3) Flush if the buffer is full
     */
-    if ((out->flag & _LBF && c == '\n') || out->flag & _NBF || _deque_full(out->buf)) {
+    if ((out->flag & _LBF && c == '\n') || out->flag & _NBF || out->end == out->base + out->size) {
         if (!flushbuf(out))
             return EOF;
     }
@@ -342,31 +761,9 @@ int fputc(int c, FILE *out)
 */
 int ungetc(int c, FILE *in)
 {
-    /* The stream must be both open and in read mode */
-    if (!(in->flag & _OPEN) || in->flag & _WRITE)
-        return EOF;
-
-    /* Reset the stream to read mode */
-    in->flag &= ~_WRITE;
-    in->flag |= _READ;
-
-    /* The unget buffer may have been lazy initialized (see fopen), create it now */
-    if (!_deque_ready(in->unget)) {
-        char *buf = (char*)_sys_alloc(_UNGETSIZ);
-
-        if (!buf)
-            return EOF;
-
-        _deque_init(in->unget, buf, _UNGETSIZ);
-        in->flag |= _ALLOC;
-    }
-
-    /* Make sure an unget can be performed with the current buffer */
-    if (_deque_full(in->unget))
-        return EOF;
-
-    _deque_pushf(in->unget, (char)c);
-    in->flag &= ~_EOF; /* A pushback clears the EOF state */
+    flockfile(in);
+    c = ungetc_unlocked(c, in);
+    funlockfile(in);
 
     return c;
 }
@@ -382,21 +779,28 @@ int fflush(FILE *out)
     int rc = 0;
 
     if (out) {
+        flockfile(out);
+
         /* The stream must be both open and in write mode */
-        if (!(out->flag & _OPEN) || out->flag & _READ || !flushbuf(out))
+        if (!(out->flag & _OPEN) || out->flag & _READ || !syncbuf(out))
             rc = EOF;
+
+        funlockfile(out);
     }
     else {
-        size_t i;
+        _lock_acquire(&io_lock);
 
-        /* Flush ALL the things! :D */
-        for (i = 0; i < FOPEN_MAX; ++i) {
-            out = &__io_buf[i]; /* Sacrifice a little for notational consistency */
+        /* Flush ALL the things! :D (only streams in write mode have anything to flush) */
+        for (out = __io_open; out; out = out->next) {
+            flockfile(out);
 
-            /* The stream must be both open and in write mode */
-            if (!(out->flag & _OPEN) || out->flag & _READ || !flushbuf(out))
+            if (out->flag & _WRITE && !syncbuf(out))
                 rc = EOF;
+
+            funlockfile(out);
         }
+
+        _lock_release(&io_lock);
     }
 
     return rc;
@@ -411,30 +815,93 @@ int fflush(FILE *out)
 */
 char *fgets(char * restrict s, int n, FILE * restrict in)
 {
-    char *p = s;
-    int ch;
+    size_t count = 0;
+    bool found;
 
-    while (--n > 0) {
-        if ((ch = fgetc(in)) == EOF || (*p++ = (char)ch) == '\n')
-            break;
-    }
+    flockfile(in);
+
+    if (n > 1)
+        count = read_line(in, '\n', s, n - 1, &found);
 
-    if (p != s && !ferror(in)) {
-        *p = '\0';
+    funlockfile(in);
+
+    if (count > 0 && !ferror(in)) {
+        s[count] = '\0';
         return s;
     }
     
     return NULL;
 }
 
+/*
+    @description:
+        Reads characters from the stream pointed to by in up to and including
+        the first occurrence of delim, or up to end-of-file, into the buffer
+        pointed to by *line, which holds *n characters. The buffer is allocated
+        (or reallocated) with realloc as needed, and the result is always
+        terminated with a null character. Returns the number of characters
+        read without the null character, or -1 on error or if nothing was read.
+*/
+ssize_t getdelim(char ** restrict line, size_t * restrict n, int delim, FILE * restrict in)
+{
+    size_t count = 0;
+    size_t room, got;
+    bool found = false;
+
+    if (!line || !n) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    flockfile(in);
+
+    do {
+        /* Grow the buffer when there's no room past the null character, doubling each time */
+        if (!*line || *n - count < 2) {
+            size_t size = *line && *n >= _LINESIZ ? *n * 2 : _LINESIZ;
+            char *p = (char*)realloc(*line, size);
+
+            if (!p) {
+                errno = ENOMEM;
+                funlockfile(in);
+                return -1;
+            }
+
+            *line = p;
+            *n = size;
+        }
+
+        room = *n - count - 1;
+        got = read_line(in, delim, *line + count, room, &found);
+        count += got;
+    } while (!found && got == room); /* A short read means end-of-file or an error */
+
+    funlockfile(in);
+
+    if (count == 0 || ferror(in))
+        return -1;
+
+    (*line)[count] = '\0';
+
+    return (ssize_t)count;
+}
+
+/*
+    @description:
+        Equivalent to getdelim with a newline as the delimiter.
+*/
+ssize_t getline(char ** restrict line, size_t * restrict n, FILE * restrict in)
+{
+    return getdelim(line, n, '\n', in);
+}
+
 /*
     @description:
         Writes the string pointed to by s to the stream pointed to by stream.
 */
 int fputs(const char * restrict s, FILE * restrict out)
 {
-    while (*s)
-        fputc(*s++, out);
+    fwrite(s, 1, strlen(s), out);
 
     return ferror(out);
 }
@@ -445,8 +912,23 @@ int fputs(const char * restrict s, FILE * restrict out)
 */
 int puts(const char *s)
 {
-    fputs(s, stdout);
-    fputc('\n', stdout);
+    if (stdout->flag & _LOG) {
+        struct _sys_iovec rec[2];
+
+        /* The line and its newline make one record */
+        rec[0].base = (void*)s;
+        rec[0].len = strlen(s);
+        rec[1].base = "\n";
+        rec[1].len = 1;
+
+        return log_append(stdout, rec, 2) ? 0 : EOF;
+    }
+
+    /* Keep the line in one piece when other threads are writing too */
+    flockfile(stdout);
+    fwrite_unlocked(s, 1, strlen(s), stdout);
+    fputc_unlocked('\n', stdout);
+    funlockfile(stdout);
 
     return ferror(stdout);
 }
@@ -457,6 +939,19 @@ int puts(const char *s)
         size is specified by size, from the stream pointed to by stream.
 */
 size_t fread(void * restrict p, size_t size, size_t n, FILE * restrict in)
+{
+    flockfile(in);
+    n = fread_unlocked(p, size, n, in);
+    funlockfile(in);
+
+    return n;
+}
+
+/*
+    @description:
+        Equivalent to fread, except that the caller is responsible for locking.
+*/
+size_t fread_unlocked(void * restrict p, size_t size, size_t n, FILE * restrict in)
 {
     if (size == 0 || n == 0)
         return 0;
@@ -464,12 +959,56 @@ size_t fread(void * restrict p, size_t size, size_t n, FILE * restrict in)
         size_t bytes = n * size;
         size_t count = 0;
         char *dst = (char*)p;
-        int ch;
 
-        while (count < bytes && (ch = fgetc(in)) != EOF)
-            *dst++ = (char)ch;
+        /* The stream must be both open and in read mode */
+        if (!(in->flag & _OPEN) || in->flag & _WRITE)
+            return 0;
 
-        return count;
+        /* Reset the stream to read mode */
+        in->flag &= ~_WRITE;
+        in->flag |= _READ;
+
+        /* Pushed back characters are always delivered first */
+        while (count < bytes && in->nunget > 0)
+            dst[count++] = in->unget[--in->nunget];
+
+        while (count < bytes) {
+            if (in->begin != in->end) {
+                /* Drain as much of the buffer as the request can hold */
+                count += read_buffered(in, dst + count, bytes - count);
+            }
+            else if (!(in->flag & (_PEEK | _MAP | _ASYNC)) && bytes - count >= in->size) {
+                /*
+                    The rest of the request would take at least one full buffer,
+                    so skip the extra copy and read straight into the caller's
+                    memory. Newlines on text streams are compacted in place.
+                    Mapped streams are already copied only once, and async
+                    streams may have the next block read ahead already.
+                */
+                int nread = device_read(in, dst + count, bytes - count);
+
+                if (nread < 0) {
+                    in->flag |= _ERR;
+                    break;
+                }
+                else if (nread == 0) {
+                    in->flag |= _EOF;
+                    break;
+                }
+
+                in->pos += nread;
+
+                if (in->flag & _TEXT)
+                    nread = compact_newlines(in, dst + count, nread);
+
+                count += nread;
+            }
+            else if (!fillbuf(in)) {
+                break;
+            }
+        }
+
+        return count / size;
     }
 }
 
@@ -480,32 +1019,106 @@ size_t fread(void * restrict p, size_t size, size_t n, FILE * restrict in)
 */
 size_t fwrite(const void * restrict p, size_t size, size_t n, FILE * restrict out)
 {
-    if ( size == 0 || n == 0 )
-        return 0;
-    else {
-        size_t bytes = n * size;
-        size_t count = 0;
-        const char *temp = (const char*)p;
+    /* Log streams don't lock */
+    if (out->flag & _LOG)
+        return fwrite_unlocked(p, size, n, out);
 
-        while (count < bytes && fputc(*temp++, out) != EOF)
-            ++count;
+    flockfile(out);
+    n = fwrite_unlocked(p, size, n, out);
+    funlockfile(out);
 
-        return count;
-    }
+    return n;
 }
 
 /*
     @description:
-        Writes output to the stream pointed to by out, under control of the
-        string pointed to by fmt that specifies how subsequent arguments are
-        converted for output.
+        Equivalent to fwrite, except that the caller is responsible for locking.
 */
-int fprintf(FILE * restrict out, const char * restrict fmt, ...)
+size_t fwrite_unlocked(const void * restrict p, size_t size, size_t n, FILE * restrict out)
 {
-    va_list args;
-    int rv;
+    if ( size == 0 || n == 0 )
+        return 0;
+    else {
+        size_t bytes = n * size;
+        size_t count = 0;
+        const char *src = (const char*)p;
 
-    va_start(args, fmt);
+        /* The stream must be both open and in write mode (the mapping is read-only) */
+        if (!(out->flag & _OPEN) || out->flag & (_READ | _MAP))
+            return 0;
+
+        /* Reset the stream to write mode */
+        out->flag &= ~_READ;
+        out->flag |= _WRITE;
+
+        if (out->flag & _LOG) {
+            struct _sys_iovec rec;
+
+            rec.base = (void*)src;
+            rec.len = bytes;
+
+            return log_append(out, &rec, 1) ? n : 0;
+        }
+
+        if (!(out->flag & (_TEXT | _ASYNC)) && bytes >= out->size) {
+            /*
+                The request would fill the buffer at least once, so deliver
+                anything pending and then write straight from the caller's
+                memory. Text streams still need newline expansion, and
+                async streams keep writing behind through their buffers.
+            */
+            int nwritten;
+
+            if (out->begin != out->end && !flushbuf(out))
+                return 0;
+
+            if ((nwritten = device_write(out, src, bytes)) < 0) {
+                out->flag |= _ERR;
+                return 0;
+            }
+
+            out->pos += nwritten;
+
+            /* Only a full memory stream writes less than everything */
+            if ((size_t)nwritten < bytes)
+                out->flag |= _ERR;
+
+            return nwritten / size;
+        }
+
+        while (count < bytes) {
+            count += write_buffered(out, src + count, bytes - count);
+
+            /* Flush if the buffer is full or couldn't take the rest of the request */
+            if ((count < bytes || out->end == out->base + out->size) && !flushbuf(out))
+                return count / size;
+        }
+
+        /*
+            1) Flush if a newline was written.
+            2) Always flush if buffering is turned off.
+        */
+        if ((out->flag & _LBF && memchr(src, '\n', bytes)) || out->flag & _NBF) {
+            if (!flushbuf(out))
+                return 0;
+        }
+
+        return count / size;
+    }
+}
+
+/*
+    @description:
+        Writes output to the stream pointed to by out, under control of the
+        string pointed to by fmt that specifies how subsequent arguments are
+        converted for output.
+*/
+int fprintf(FILE * restrict out, const char * restrict fmt, ...)
+{
+    va_list args;
+    int rv;
+
+    va_start(args, fmt);
     rv = vfprintf(out, fmt, args);
     va_end(args);
 
@@ -570,7 +1183,18 @@ int sprintf(char * restrict s, const char * restrict fmt, ...)
 */
 int vfprintf(FILE * restrict out, const char * restrict fmt, va_list args)
 {
-    return _printf(write_stream, out, fmt, (size_t)-1, args);
+    int rv;
+
+    /* Log streams format the record first and then append it in one piece */
+    if (out->flag & _LOG)
+        return log_printf(out, fmt, args);
+
+    /* One lock for the whole call keeps the output in one piece */
+    flockfile(out);
+    rv = _printf(write_stream, out, fmt, (size_t)-1, args);
+    funlockfile(out);
+
+    return rv;
 }
 
 /*
@@ -579,7 +1203,7 @@ int vfprintf(FILE * restrict out, const char * restrict fmt, va_list args)
 */
 int vprintf(const char * restrict fmt, va_list args)
 {
-    return _printf(write_stream, stdout, fmt, (size_t)-1, args);
+    return vfprintf(stdout, fmt, args);
 }
 
 /*
@@ -665,7 +1289,13 @@ int sscanf(const char * restrict s, const char * restrict fmt, ...)
 */
 int vfscanf(FILE * restrict in, const char * restrict fmt, va_list args)
 {
-    return _scanf(read_stream, unget_stream, in, fmt, args);
+    int rv;
+
+    flockfile(in);
+    rv = _scanf(read_stream, unget_stream, in, fmt, args);
+    funlockfile(in);
+
+    return rv;
 }
 
 /*
@@ -674,7 +1304,7 @@ int vfscanf(FILE * restrict in, const char * restrict fmt, va_list args)
 */
 int vscanf(const char * restrict fmt, va_list args)
 {
-    return _scanf(read_stream, unget_stream, stdin, fmt, args);
+    return vfscanf(stdin, fmt, args);
 }
 
 /*
@@ -730,353 +1360,2354 @@ void perror(const char *s)
 
 /* 
     ===================================================
-                Static helper definitions
+              Extension function definitions
     ===================================================
 */
 
 /*
     @description:
-        Generates the full path for a temporary file.
+        Acquires the lock for the stream pointed to by stream, blocking
+        while another thread holds it. Locks are recursive, so a thread
+        that already holds the lock may acquire it again.
 */
-char *get_temp_name(char *buf)
+void flockfile(FILE *stream)
 {
-    int len = _sys_temppath(buf, L_tmpnam);
+    _lock_acquire(&stream->lock);
+}
 
-    if (len > L_tmpnam || len == 0 || _sys_tempfilename(buf, "", buf + len) == 0)
-        return NULL;
+/*
+    @description:
+        Equivalent to flockfile, but returns nonzero instead of
+        blocking if another thread holds the lock.
+*/
+int ftrylockfile(FILE *stream)
+{
+    return _lock_try(&stream->lock) ? 0 : -1;
+}
 
-    return buf;
+/*
+    @description:
+        Releases one acquisition of the lock for the stream pointed to by stream.
+*/
+void funlockfile(FILE *stream)
+{
+    _lock_release(&stream->lock);
 }
 
 /*
     @description:
-        Retrieves an unused handle from the requested collection.
+        Reads into the n blocks described by iov, in order, from the
+        stream pointed to by in. Returns the total number of bytes read,
+        which is short only on end-of-file or error. Anything read past
+        the last block stays buffered for later reads.
 */
-FILE *get_unused_handle(FILE handles[], size_t limit)
+size_t _freadv(FILE * restrict in, const struct _sys_iovec *iov, int n)
 {
-    size_t i;
+    size_t count = 0;
 
-    for (i = 0; i < limit; i++) {
-        /* Only unused handles will have a totally clear flag */
-        if (handles[i].flag == 0)
-            return &handles[i];
+    flockfile(in);
+
+    /* The stream must be both open and in read mode */
+    if (in->flag & _OPEN && !(in->flag & _WRITE)) {
+        /* Reset the stream to read mode */
+        in->flag |= _READ;
+        count = read_vector(in, iov, n);
     }
 
-    return NULL;
+    funlockfile(in);
+
+    return count;
 }
 
 /*
     @description:
-        Opens or reopens a file with the specified mode.
+        Writes the n blocks described by iov, in order, to the stream
+        pointed to by out. Returns the total number of bytes written.
+        Blocks that don't fit in the buffer go out, together with
+        anything already buffered, in one vectored write.
 */
-FILE *file_open(FILE *file, const char * restrict filename, const char * restrict mode, bool tempfile)
+size_t _fwritev(FILE * restrict out, const struct _sys_iovec *iov, int n)
 {
-    if (!file) {
-        FILE *handles = tempfile ? __io_tmp : __io_buf;
-        size_t limit = tempfile ? TMP_MAX : FOPEN_MAX;
+    size_t bytes = 0;
+    int i;
 
-        /* Create a new FILE instead of reopening an old one */
-        file = get_unused_handle(handles, limit);
-    }
-    
-    if (file) {
-        int orient, attr, share;
+    for (i = 0; i < n; ++i)
+        bytes += iov[i].len;
 
-        if (_sys_parse_openmode(mode, &file->flag, &orient, &attr, &share)) {
-            if ((file->fd = _sys_openfile(filename, orient, attr, share)) != _SYS_BADHANDLE) {
-                char *buf = (char*)_sys_alloc(BUFSIZ);
+    /* The stream must be both open and in write mode (the mapping is read-only) */
+    if (!(out->flag & _OPEN) || out->flag & (_READ | _MAP))
+        return 0;
 
-                if (!buf || (tempfile && !(file->tmp = (char*)_sys_alloc(L_tmpnam)))) {
-                    _sys_free(buf);
-                    _sys_closefile(file->fd);
-                }
-                else {
-                    /* Finalize the temporary status now that all memory is prepped */
-                    if (tempfile) {
-                        strcpy(file->tmp, filename);
-                        file->flag |= _TEMP;
-                    }
+    /* The blocks of a log stream make one record, and log streams don't lock */
+    if (out->flag & _LOG)
+        return log_append(out, iov, n) ? bytes : 0;
 
-                    /* Initialize the buffer, set the initial flags, and we're good to go */
-                    _deque_init(file->buf, buf, BUFSIZ);
-                    file->flag |= (_OWNED | _LBF | _OPEN);
-                    
-                    return file;
-                }
-            }
-        }
-    }
+    flockfile(out);
 
-    return NULL;
+    /* Reset the stream to write mode */
+    out->flag &= ~_READ;
+    out->flag |= _WRITE;
+
+    bytes = write_vector(out, iov, n, bytes);
+    funlockfile(out);
+
+    return bytes;
 }
 
 /*
     @description:
-        Counts the number of bytes currently stored in a deque
-        as if newlines were expanded to the system representation.
-
-        The count can be performed as either a stack or as a queue.
+        Refills the buffers of the streams in the array that are
+        readable and have run dry, batching the reads across streams
+        into as few system calls as the system allows. Streams that
+        another thread holds are skipped. Returns the number of
+        streams with buffered input afterwards.
 */
-size_t count_newline_diff(struct _deque *buf, bool as_stack)
+int _ffill(FILE *streams[], int n)
 {
-    size_t i = as_stack ? buf->front : buf->back;
-    size_t diff = 0;
-    size_t n = 0;
+    struct _sys_ioreq req[_FILLBATCH];
+    FILE *batch[_FILLBATCH];
+    int ready = 0;
+    int i = 0;
+
+    while (i < n) {
+        int nreq = 0;
+        int k;
+
+        /* Lock and pick out the streams that need a read */
+        for (; i < n && nreq < _FILLBATCH; ++i) {
+            FILE *in = streams[i];
+
+            /* The lock is recursive, so a stream listed twice would get two reads into one buffer */
+            for (k = 0; k < nreq && batch[k] != in; ++k)
+                ;
+
+            if (k < nreq || ftrylockfile(in) != 0)
+                continue;
+
+            /*
+                Only plain buffered streams in (or able to enter) read mode
+                are refilled here, fillbuf handles everything else later.
+            */
+            if (in->flag & _OPEN && !(in->flag & (_WRITE | _MAP | _ASYNC | _NOHANDLE | _PEEK | _EOF | _ERR)) &&
+                in->nunget == 0 && in->begin == in->end)
+            {
+                batch[nreq] = in;
+                req[nreq].fd = in->fd;
+                req[nreq].write = 0;
+                req[nreq].buf = in->base;
+                req[nreq].len = in->size;
+                ++nreq;
+            }
+            else {
+                if (in->flag & _READ && (in->nunget > 0 || in->begin != in->end))
+                    ++ready;
 
-    while (n++ < buf->fill) {
-        if (as_stack)
-            _wrap_incr(i, buf->size);
-        else
-            _wrap_decr(i, buf->size);
+                funlockfile(in);
+            }
+        }
+
+        if (nreq > 0)
+            _sys_iobatch(req, nreq);
+
+        for (k = 0; k < nreq; ++k) {
+            FILE *in = batch[k];
+            int nread = req[k].result;
+
+            /* Reset the stream to read mode */
+            in->flag |= _READ;
 
-        if (buf->base[i] == '\n')
-            ++diff;
+            if (nread < 0)
+                in->flag |= _ERR; /* There was a stream error */
+            else if (nread == 0)
+                in->flag |= _EOF; /* We hit end-of-file */
+            else {
+                in->pos += nread;
+
+                if (in->flag & _TEXT)
+                    nread = compact_newlines(in, in->base, nread);
+
+                in->begin = in->base;
+                in->end = in->base + nread;
+                in->mark = NULL;
+
+                if (nread > 0)
+                    ++ready;
+            }
+
+            funlockfile(in);
+        }
     }
 
-    return diff;
+    return ready;
 }
 
 /*
     @description:
-        Counts the number of bytes currently stored in the stream 
-        buffer as if newlines were expanded to the system representation.
+        Reads, into the array pointed to by p, up to n elements whose size
+        is specified by size, from the file behind the stream pointed to
+        by in, starting at offset. The file position is neither used nor
+        moved, so several threads can read one stream at once. Small reads
+        are served from a window of the file kept by the stream. There's
+        no text translation. Big reads use the stream's handle without
+        holding its lock, so the stream must stay open until they return.
 */
-size_t count_buffer_bytes(FILE *stream)
+size_t _fpread(void * restrict p, size_t size, size_t n, fpos_t offset, FILE * restrict in)
 {
-    size_t bytes = stream->buf.fill;
-    size_t unget = stream->unget.fill;
+    size_t bytes = size * n;
+    size_t count = 0;
+    char *dst = (char*)p;
 
-    /* Account for newline compaction on text streams */
-    if (stream->flag & _TEXT) {
-        bytes += count_newline_diff(&stream->buf, false);
-        unget += count_newline_diff(&stream->unget, true);
+    if (bytes == 0 || offset < 0)
+        return 0;
+
+    flockfile(in);
+
+    /* Memory and custom streams have no handle to read at an offset (an in-memory tmpfile gets one) */
+    if (!(in->flag & _OPEN) || !ensure_handle(in)) {
+        funlockfile(in);
+        return 0;
     }
 
-    return bytes + unget;
+    /* Buffered output has to reach the file first (which drops the window it makes stale) */
+    if (in->flag & _WRITE && !syncbuf(in)) {
+        funlockfile(in);
+        return 0;
+    }
+
+    if (bytes >= _PCACHESIZ) {
+        /* Big reads go straight to the caller, and other readers needn't wait on them */
+        _sys_handle_t fd = in->fd;
+
+        funlockfile(in);
+
+        while (count < bytes) {
+            int nread = _sys_pread(fd, dst + count, bytes - count, offset + count);
+
+            if (nread < 0) {
+                flockfile(in);
+                in->flag |= _ERR;
+                funlockfile(in);
+            }
+
+            if (nread <= 0)
+                break;
+
+            count += nread;
+        }
+
+        return count / size;
+    }
+
+    while (count < bytes) {
+        struct _pcache *cache = in->pcache;
+        fpos_t pos = offset + count;
+        size_t avail;
+
+        if (!cache || pos < cache->off || pos >= cache->off + (fpos_t)cache->len) {
+            if (!pcache_fill(in, pos, bytes - count))
+                break;
+
+            cache = in->pcache;
+
+            /* Still nothing at pos means it's past the end of the file */
+            if (pos >= cache->off + (fpos_t)cache->len)
+                break;
+        }
+
+        avail = (size_t)(cache->off + cache->len - pos);
+
+        if (avail > bytes - count)
+            avail = bytes - count;
+
+        memcpy(dst + count, cache->buf + (size_t)(pos - cache->off), avail);
+        count += avail;
+    }
+
+    funlockfile(in);
+
+    return count / size;
 }
 
 /*
     @description:
-        Gets the current file position indicator for the specified stream.
+        Writes, from the array pointed to by p, up to n elements whose
+        size is specified by size, to the file behind the stream pointed
+        to by out, starting at offset. The file position is neither used
+        nor moved. Output already buffered by the stream goes first.
+        There's no text translation, and data already buffered for
+        ordinary reads isn't refreshed.
 */
-bool intern_tell(FILE *stream, fpos_t *new_pos)
+size_t _fpwrite(const void * restrict p, size_t size, size_t n, fpos_t offset, FILE * restrict out)
 {
-    if (!_sys_tell(stream->fd, new_pos)) {
-        errno = EGETP;
-        return false;
+    size_t bytes = size * n;
+    int nwritten = 0;
+
+    if (bytes == 0 || offset < 0)
+        return 0;
+
+    flockfile(out);
+
+    /* The stream must be open, not a read-only mapping, and have a handle (an in-memory tmpfile gets one) */
+    if (out->flag & _OPEN && !(out->flag & _MAP) && ensure_handle(out) && (!(out->flag & _WRITE) || syncbuf(out))) {
+        struct _pcache *cache = out->pcache;
+
+        /* The window may hold what's about to be overwritten */
+        if (cache && offset < cache->off + (fpos_t)cache->len && offset + (fpos_t)bytes > cache->off)
+            cache->len = 0;
+
+        if ((nwritten = _sys_pwrite(out->fd, (void*)p, bytes, offset)) < 0) {
+            out->flag |= _ERR;
+            nwritten = 0;
+        }
     }
 
-    *new_pos -= count_buffer_bytes(stream);
+    funlockfile(out);
 
-    return true;
+    return nwritten / size;
 }
 
 /*
     @description:
-        Sets the current file position indicator for the specified stream.
+        Copies up to n characters from the stream pointed to by src to the
+        stream pointed to by dst, stopping early at end-of-file or on an
+        error, and returns the number of characters copied. Buffered data
+        goes first. After that, files are copied by the system without
+        passing through memory where possible, and in large blocks
+        otherwise. Text streams are copied as fread and fwrite would.
 */
-bool intern_seek(FILE *stream, fpos_t offset, int whence)
+size_t _fcopy(FILE * restrict dst, FILE * restrict src, size_t n)
 {
-    /*
-        SEEK_CUR is a pain, especially with padding and text expansion.
-        Ignore it completely and work from SEEK_SET instead.
-    */
-    if (whence == SEEK_CUR) {
-        fpos_t curr;
-
-        if (!intern_tell(stream, &curr)) {
-            errno = ESETP;
-            return false;
-        }
+    size_t count = 0;
 
-        offset += curr;
-        whence = SEEK_SET;
-    }
-
-    /* Flush output streams in write mode, discard otherwise */
-    if (stream->flag & _WRITE)
-        flushbuf(stream);
-    else
-        _deque_init(stream->buf, stream->buf.base, stream->buf.size);
+    if (dst == src)
+        return 0;
 
-    /* Clear the unget buffer if present */
-    if (_deque_ready(stream->unget))
-        _deque_init(stream->unget, stream->unget.base, stream->unget.size);
+    /* Always lock in the same order, so two copies in opposite directions can't deadlock */
+    flockfile(dst < src ? dst : src);
+    flockfile(dst < src ? src : dst);
 
-    /* The next operation may be a read or a write */
-    stream->flag &= ~(_READ | _WRITE);
-    stream->flag &= ~_EOF;
+    /* The source must be in read mode and the destination in write mode (the mapping is read-only) */
+    if (src->flag & _OPEN && !(src->flag & _WRITE) && dst->flag & _OPEN && !(dst->flag & (_READ | _MAP)))
+        count = copy_stream(dst, src, n);
 
-    if (!_sys_seek(stream->fd, offset, whence)) {
-        errno = ESETP;
-        return false;
-    }
+    funlockfile(src);
+    funlockfile(dst);
 
-    return true;
+    return count;
 }
 
 /*
     @description:
-        Peeks ahead by one character in the source device.
+        Sets the buffer size for subsequently opened streams, kept between
+        _MINBUFSIZ and _BUFMAX, and returns the previous setting. A size of
+        0 restores automatic sizing, where the buffer starts at the file's
+        preferred I/O size and grows up to _BUFMAX for as long as the
+        stream is read or written sequentially.
+
+        Before the first call, the STDIO_BUFSIZ environment variable (a
+        byte count with an optional K or M suffix) is used if present.
 */
-int peekbuf(FILE *in)
+size_t _setbufsiz(size_t size)
 {
-    if (_sys_read(in->fd, &in->peek, 1) < 1)
-        return EOF;
+    size_t old = get_default_bufsiz();
 
-    in->flag |= _PEEK;
+    default_bufsiz = bound_bufsiz(size);
 
-    return in->peek;
+    return old;
 }
 
 /*
     @description:
-        Fills the buffer with characters from the source device.
+        Sets the size past which the data of a stream from tmpfile moves
+        from memory to a real file, and returns the previous setting. A
+        size of 0 puts new temporary files on disk from the start.
 */
-bool fillbuf(FILE *in)
+size_t _settmpspill(size_t size)
 {
-    char *temp = (char*)_sys_alloc(in->buf.size);
-
-    if (!temp)
-        in->flag |= _ERR;
-    else {
-        bool has_peek = (in->flag & _PEEK) != 0;
-        size_t nread;
+    size_t old = tmp_spill;
 
-        /* Grab the peeked character if present */
-        if (has_peek)
-            *temp++ = in->peek;
+    tmp_spill = size;
 
-        /*
-            Fill the temporary buffer from the system stream, taking care
-            not to overwrite or over read due to a peeked character.
-        */
-        nread = _sys_read(in->fd, temp + has_peek, in->buf.size - has_peek);
+    return old;
+}
 
-        if (nread < 0)
-            in->flag |= _ERR; /* There was a stream error */
-        else if (nread == 0 && !has_peek)
-            in->flag |= _EOF; /* We hit end-of-file immediately */
-        else {
-            char *buf = in->buf.base;
+/* 
+    ===================================================
+                Static helper definitions
+    ===================================================
+*/
 
-            nread += has_peek; /* Account for a peeked character */
+/*
+    @description:
+        Generates the full path for a temporary file.
+*/
+char *get_temp_name(char *buf)
+{
+    char path[L_tmpnam];
+    int len = _sys_temppath(path, L_tmpnam);
 
-            /* Finalize the temporary buffer by compacting newlines */
-            if (in->flag & _TEXT)
-                nread = compact_newlines(in, temp, nread);
+    /* The generated name includes the path, so it's built straight into buf */
+    if (len > L_tmpnam || len == 0 || _sys_tempfilename(path, "", buf) == 0)
+        return NULL;
 
-            /* Set up a new owned buffer if necessary */
-            if (!buf && in->flag & _OWNED)
-                buf = (char*)_sys_alloc(in->buf.size);
+    return buf;
+}
 
-            if (!buf)
-                in->flag |= _ERR; /* Allocation failed or a non-owned buffer was NULL */
-            else {
-                size_t i;
+/*
+    @description:
+        Retrieves an unused handle from the requested pool.
+*/
+FILE *get_unused_handle(struct file_pool *pool)
+{
+    FILE *stream;
 
-                _deque_init(in->buf, buf, in->buf.size); /* Reset the buffer for refill */
+    _lock_acquire(&io_lock);
 
-                /* Fill the stream buffer with the finished temporary buffer */
-                for (i = 0; i < nread && i < in->buf.size; ++i)
-                    _deque_pushf(in->buf, temp[i]);
-            }
-        }
+    if ((stream = pool->free) != NULL)
+        pool->free = stream->next; /* Reuse a released slot */
+    else if (pool->used < pool->limit)
+        stream = &pool->slots[pool->used++]; /* Hand out a fresh slot */
 
-        _sys_free(temp);
-    }
+    _lock_release(&io_lock);
 
-    return (in->flag & (_ERR | _EOF)) == 0;
+    return stream;
 }
 
 /*
     @description:
-        Sends buffered characters to the destination device.
+        Returns the handle of a closed stream to the pool it came from.
 */
-bool flushbuf(FILE *out)
+void release_handle(FILE *stream)
 {
-    /* Assuming every character may be a newline for expansion */
-    char *temp = (char*)_sys_alloc(out->buf.size * 2);
+    struct file_pool *pool = &io_pool;
 
-    if (!temp)
-        out->flag |= _ERR;
-    else {
-        size_t write_size = out->buf.size;
+    if (stream >= tmp_pool.slots && stream < &tmp_pool.slots[tmp_pool.limit])
+        pool = &tmp_pool;
 
-        /* Expand newlines for the output device */
-        if (out->flag & _TEXT)
-            write_size = expand_newlines(out, temp);
+    _lock_acquire(&io_lock);
+    stream->flag = 0;
+    stream->next = pool->free;
+    pool->free = stream;
+    _lock_release(&io_lock);
+}
 
-        if (_sys_write(out->fd, temp, write_size) < 0)
-            out->flag |= _ERR; /* There was a stream error */
-        else {
-            /* Reset the buffer so that we don't double flush */
-            _deque_init(out->buf, out->buf.base, out->buf.size);
-        }
+/*
+    @description:
+        Adds a newly opened stream to the front of the open stream list.
+*/
+void link_stream(FILE *stream)
+{
+    _lock_acquire(&io_lock);
 
-        _sys_free(temp);
-    }
+    stream->prev = NULL;
+    stream->next = __io_open;
 
-    return (out->flag & _ERR) == 0;
+    if (__io_open)
+        __io_open->prev = stream;
+
+    __io_open = stream;
+
+    _lock_release(&io_lock);
 }
 
 /*
     @description:
-        Converts a platform-dependent line break sequence into '\n'.
+        Removes a closing stream from the open stream list.
 */
-size_t compact_newlines(FILE *in, char *buf, size_t n)
+void unlink_stream(FILE *stream)
 {
-    char *it = buf;
-    char *save = buf;
-
-    while (it != &buf[n]) {
-        /* Compact CRLF into LF */
-        if (*it == '\r') {
-            if (&it[1] == &buf[n]) {
-                /*
-                    CR at the end of the buffer should be relatively rare, 
-                    so we can  comfortably peek on a per character basis.
-                */
+    _lock_acquire(&io_lock);
 
-                /* If we couldn't peek, CR will be saved */
-                if (peekbuf(in) == '\n') {
-                    /* We found LF; overwrite the CR so that LF is saved */
-                    *it = '\n';
+    if (stream->prev)
+        stream->prev->next = stream->next;
+    else
+        __io_open = stream->next;
 
-                    /* Reset the peek status so the extra LF is discarded */
-                    in->flag &= ~_PEEK;
-                }
-            }
-            else if (it[1] == '\n') {
-                ++it; /* The next character is LF so jump over the CR and continue */
-            }
-        }
+    if (stream->next)
+        stream->next->prev = stream->prev;
 
-        *save++ = *it++;
-    }
+    stream->prev = stream->next = NULL;
 
-    return save - buf;
+    _lock_release(&io_lock);
 }
 
 /*
     @description:
-        Converts '\n' into a suitable platform-dependent line break sequence.
+        Flushes and closes a stream, but leaves its handle in place.
 */
-size_t expand_newlines(FILE *out, char *output)
+int close_stream(FILE *stream)
 {
-    char *save = output;
+    int rc = 0;
+
+    if (stream->flag & _OPEN) {
+        /*
+            Leave the open stream list before taking the stream lock, the same
+            order as fflush(NULL), so the two can never deadlock each other.
+        */
+        unlink_stream(stream);
+        flockfile(stream);
 
-    while (!_deque_empty(out->buf)) {
-        char ch = _deque_popb(out->buf);
+        /* Try to flush if the stream is in write mode */
+        if (stream->flag & _WRITE && !syncbuf(stream))
+            rc = EOF;
 
-        /* Expand LF into CRLF */
-        if (ch == '\n')
-            *save++ = '\r';
+        /* The worker has to be gone before the handle and buffers are */
+        if (stream->flag & _ASYNC)
+            async_stop(stream);
 
-        *save++ = ch;
-    }
+        /* Try to close the underlying handle (memory and custom streams have none) */
+        if (stream->flag & _MEM) {
+            if (stream->mem->owned)
+                free(stream->mem->buf);
 
-    return save - output;
+            _sys_free(stream->mem);
+            stream->mem = NULL;
+        }
+        else if (stream->flag & _COOKIE) {
+            struct _cookie *dev = stream->cookie;
+
+            if (dev->io.close && dev->io.close(dev->cookie) != 0)
+                rc = EOF;
+
+            _sys_free(dev);
+            stream->cookie = NULL;
+        }
+        else if (!_sys_closefile(stream->fd))
+            rc = EOF;
+
+        if (stream->flag & _LOG)
+            _sys_free(stream->log);
+
+        if (stream->pcache) {
+            _sys_free(stream->pcache);
+            stream->pcache = NULL;
+        }
+
+        /* Release the mapping window or owned main buffer memory */
+        if (stream->flag & _MAP)
+            unmapbuf(stream);
+        else if (stream->flag & _OWNED)
+            _sys_free(stream->base);
+
+        if (stream->flag & _TEMP) {
+            remove(stream->tmp);    /* Temporary files are always deleted */
+            _sys_free(stream->tmp); /* Don't forget we allocated the filename */
+        }
+
+        /* Mark the stream as unused */
+        stream->flag = 0;
+        funlockfile(stream);
+    }
+
+    return rc;
+}
+
+/*
+    @description:
+        Opens or reopens a file with the specified mode.
+*/
+FILE *file_open(FILE *file, const char * restrict filename, const char * restrict mode, bool tempfile)
+{
+    if (!file) {
+        /* Create a new FILE instead of reopening an old one */
+        file = get_unused_handle(tempfile ? &tmp_pool : &io_pool);
+    }
+    
+    if (file) {
+        int orient, attr, share;
+
+        if (_sys_parse_openmode(mode, &file->flag, &orient, &attr, &share)) {
+            if ((file->fd = _sys_openfile(filename, orient, attr, share)) != _SYS_BADHANDLE) {
+                bool mapped = (file->flag & _MAP) != 0;
+                size_t size = get_default_bufsiz();
+                size_t blksize = _sys_blksize(file->fd);
+                unsigned bufmode = 0;
+                char *buf = NULL;
+
+                /* Terminals and pipes have no preferred I/O size, and stay line buffered whatever the size */
+                if (blksize == 0)
+                    bufmode = _LBF;
+
+                if (size == 0) {
+                    /* Automatic sizing: disk files start at their preferred I/O size and grow */
+                    if (blksize == 0)
+                        size = BUFSIZ;
+                    else {
+                        size = blksize < BUFSIZ ? BUFSIZ : blksize;
+                        bufmode = _GROW;
+                    }
+                }
+
+                /* Mapped streams read straight from the mapping, so they don't need a buffer */
+                if (!mapped)
+                    buf = (char*)_sys_alloc(size);
+
+                /* A read-only mapping can't be translated, so it must be binary */
+                if ((!buf && !mapped) || (mapped && file->flag & _TEXT) ||
+                    (tempfile && !(file->tmp = (char*)_sys_alloc(L_tmpnam))))
+                {
+                    _sys_free(buf);
+                    _sys_closefile(file->fd);
+                }
+                else {
+                    /* Finalize the temporary status now that all memory is prepped */
+                    if (tempfile) {
+                        strcpy(file->tmp, filename);
+                        file->flag |= _TEMP;
+                    }
+
+                    /* Initialize the buffer, set the initial flags, and we're good to go */
+                    file->base = file->begin = file->end = buf;
+                    file->mark = NULL;
+                    file->size = mapped ? 0 : size;
+                    file->nunget = 0;
+                    file->flag |= mapped ? _OPEN : (_OWNED | bufmode | _OPEN);
+
+                    /* A new file starts at the beginning, except where writes always append */
+                    if (!(file->flag & _APPEND)) {
+                        file->pos = 0;
+                        file->flag |= _POS;
+                    }
+                    link_stream(file);
+                    
+                    return file;
+                }
+            }
+        }
+
+        /* Don't leave a half-opened handle looking like it's in use */
+        release_handle(file);
+    }
+
+    return NULL;
+}
+
+/*
+    @description:
+        Pushes back a character without locking (see ungetc).
+*/
+int ungetc_unlocked(int c, FILE *in)
+{
+    /* The stream must be both open and in read mode */
+    if (!(in->flag & _OPEN) || in->flag & _WRITE)
+        return EOF;
+
+    /* Reset the stream to read mode */
+    in->flag &= ~_WRITE;
+    in->flag |= _READ;
+
+    /* Make sure an unget can be performed with the current buffer */
+    if (c == EOF || in->nunget == _UNGETSIZ)
+        return EOF;
+
+    in->unget[in->nunget++] = (char)c;
+    in->flag &= ~_EOF; /* A pushback clears the EOF state */
+
+    return c;
+}
+
+/*
+    @description:
+        Retrieves the buffer size for new streams, picking up
+        the STDIO_BUFSIZ environment variable on first use.
+*/
+size_t get_default_bufsiz(void)
+{
+    static bool checked = false;
+
+    if (!checked) {
+        const char *env = getenv("STDIO_BUFSIZ");
+
+        checked = true;
+
+        if (env) {
+            unsigned long scale = 1;
+            unsigned long size;
+            char *end;
+
+            size = strtoul(env, &end, 10);
+
+            if (*end == 'k' || *end == 'K')
+                scale = 1024;
+            else if (*end == 'm' || *end == 'M')
+                scale = 1024 * 1024;
+
+            /* A size that overflowed strtoul or wraps when scaled is ignored */
+            if (size < (unsigned long)-1 / scale)
+                default_bufsiz = bound_bufsiz(size * scale);
+        }
+    }
+
+    return default_bufsiz;
+}
+
+/*
+    @description:
+        Keeps a buffer size setting between _MINBUFSIZ and _BUFMAX,
+        leaving 0 (automatic sizing) alone.
+*/
+size_t bound_bufsiz(size_t size)
+{
+    if (size == 0)
+        return 0;
+
+    return size < _MINBUFSIZ ? _MINBUFSIZ : size > _BUFMAX ? _BUFMAX : size;
+}
+
+/*
+    @description:
+        Counts the number of unread bytes currently stored in the stream 
+        buffer as if newlines were expanded to the system representation.
+*/
+size_t count_buffer_bytes(FILE *stream)
+{
+    size_t bytes = stream->end - stream->begin;
+    size_t unget = stream->nunget;
+
+    /*
+        Account for newline compaction on text streams. The buffer is
+        counted once per fill, after that only the characters consumed
+        since the last call are, so repeated calls stay cheap.
+    */
+    if (stream->flag & _TEXT) {
+        if (!stream->mark)
+            stream->lines = _memcount(stream->begin, '\n', bytes);
+        else
+            stream->lines -= _memcount(stream->mark, '\n', stream->begin - stream->mark);
+
+        stream->mark = stream->begin;
+        bytes += stream->lines;
+        unget += _memcount(stream->unget, '\n', unget);
+    }
+
+    return bytes + unget;
+}
+
+/*
+    @description:
+        Copies up to n buffered characters from the stream into dst.
+*/
+size_t read_buffered(FILE *in, char *dst, size_t n)
+{
+    size_t avail = in->end - in->begin;
+
+    if (n > avail)
+        n = avail;
+
+    memcpy(dst, in->begin, n);
+    in->begin += n;
+
+    return n;
+}
+
+/*
+    @description:
+        Copies up to n characters from the stream into dst, stopping after
+        the first occurrence of delim. Whole spans of the buffer are copied
+        at a time, refilling it as needed. found tells whether delim was
+        reached, otherwise fewer than n characters means end-of-file or an
+        error.
+*/
+size_t read_line(FILE *in, int delim, char *dst, size_t n, bool *found)
+{
+    size_t count = 0;
+
+    *found = false;
+
+    /* The stream must be both open and in read mode */
+    if (!(in->flag & _OPEN) || in->flag & _WRITE)
+        return 0;
+
+    /* Reset the stream to read mode */
+    in->flag &= ~_WRITE;
+    in->flag |= _READ;
+
+    /* Pushed back characters are always delivered first */
+    while (count < n && in->nunget > 0) {
+        if ((dst[count++] = in->unget[--in->nunget]) == (char)delim) {
+            *found = true;
+            return count;
+        }
+    }
+
+    while (count < n) {
+        size_t avail, span;
+
+        if (in->begin == in->end && !fillbuf(in))
+            break;
+
+        avail = in->end - in->begin;
+
+        if (avail > n - count)
+            avail = n - count;
+
+        /* Take everything up to and including the delimiter, or the whole span if it isn't there */
+        if ((span = _memscan(in->begin, delim, avail)) < avail) {
+            ++span;
+            *found = true;
+        }
+
+        memcpy(dst + count, in->begin, span);
+        in->begin += span;
+        count += span;
+
+        if (*found)
+            break;
+    }
+
+    return count;
+}
+
+/*
+    @description:
+        Copies up to n characters from src into the stream's buffer,
+        stopping when the buffer is full.
+*/
+size_t write_buffered(FILE *out, const char *src, size_t n)
+{
+    size_t avail = out->size - (out->end - out->base);
+
+    /* Text streams expand newlines on the way in */
+    if (out->flag & _TEXT)
+        return expand_newlines(out, src, n);
+
+    if (n > avail)
+        n = avail;
+
+    memcpy(out->end, src, n);
+    out->end += n;
+
+    return n;
+}
+
+/*
+    @description:
+        Reads into n blocks, delivering pushed back and buffered
+        characters first. The rest is read with as few system calls
+        as possible, straight into the blocks, with the stream buffer
+        as one extra block at the end to catch read-ahead.
+*/
+size_t read_vector(FILE *in, const struct _sys_iovec *iov, int n)
+{
+    struct _sys_iovec local[_IOVLOCAL], *v = local;
+    size_t count = 0;
+    size_t off = 0;
+    int i, nv;
+
+    for (i = 0; i < n; ++i, off = 0) {
+        char *dst = (char*)iov[i].base;
+
+        while (off < iov[i].len && in->nunget > 0)
+            dst[off++] = in->unget[--in->nunget];
+
+        off += read_buffered(in, dst + off, iov[i].len - off);
+        count += off;
+
+        /* The block is only partly filled, so there's nothing left buffered */
+        if (off < iov[i].len)
+            break;
+    }
+
+    if (i == n)
+        return count;
+
+    nv = n - i + 1;
+
+    /* Memory and custom streams have no handle, so each block is read from the device directly */
+    if (in->flag & _NOHANDLE && !(in->flag & (_PEEK | _TEXT))) {
+        for (; i < n; ++i, off = 0) {
+            while (off < iov[i].len) {
+                int nread = device_read(in, (char*)iov[i].base + off, iov[i].len - off);
+
+                if (nread < 0) {
+                    in->flag |= _ERR;
+                    return count;
+                }
+                else if (nread == 0) {
+                    in->flag |= _EOF;
+                    return count;
+                }
+
+                in->pos += nread;
+                off += nread;
+                count += nread;
+            }
+        }
+
+        return count;
+    }
+
+    /*
+        Peeked characters, mapped windows, and newline compaction all need
+        the buffer in between, so those streams go block by block.
+    */
+    if (in->flag & (_PEEK | _MAP | _TEXT | _ASYNC | _NOHANDLE) || (nv > _IOVLOCAL && !(v = (struct _sys_iovec*)_sys_alloc(nv * sizeof *v)))) {
+        for (; i < n; ++i, off = 0) {
+            size_t want = iov[i].len - off;
+            size_t got = fread_unlocked((char*)iov[i].base + off, 1, want, in);
+
+            count += got;
+
+            if (got < want)
+                break;
+        }
+
+        return count;
+    }
+
+    memcpy(v, &iov[i], (nv - 1) * sizeof *v);
+    v[0].base = (char*)v[0].base + off;
+    v[0].len -= off;
+    v[nv - 1].base = in->base;
+    v[nv - 1].len = in->size;
+
+    for (i = 0; i < nv - 1;) {
+        int nread = _sys_readv(in->fd, &v[i], nv - i);
+
+        if (nread < 0) {
+            in->flag |= _ERR;
+            break;
+        }
+        else if (nread == 0) {
+            in->flag |= _EOF;
+            break;
+        }
+
+        in->pos += nread;
+
+        /* Skip past the blocks that were filled, and keep whatever spilled into the buffer */
+        while (i < nv - 1 && (unsigned)nread >= v[i].len) {
+            nread -= v[i].len;
+            count += v[i].len;
+            ++i;
+        }
+
+        if (i < nv - 1) {
+            v[i].base = (char*)v[i].base + nread;
+            v[i].len -= nread;
+            count += nread;
+        }
+        else {
+            in->begin = in->base;
+            in->end = in->base + nread;
+        }
+    }
+
+    if (v != local)
+        _sys_free(v);
+
+    return count;
+}
+
+/*
+    @description:
+        Writes n blocks totalling bytes. Blocks that fit are buffered like
+        fwrite would, otherwise the buffer and all of the blocks are
+        written with one system call.
+*/
+size_t write_vector(FILE *out, const struct _sys_iovec *iov, int n, size_t bytes)
+{
+    struct _sys_iovec local[_IOVLOCAL], *v = local;
+    size_t room = out->size - (out->end - out->base);
+    size_t buffered;
+    bool newline = false;
+    int i, nv = 0, nwritten;
+
+    /* Text and async streams go through the buffer, one block at a time */
+    if (out->flag & (_TEXT | _ASYNC)) {
+        size_t count = 0;
+
+        for (i = 0; i < n; ++i) {
+            size_t put = fwrite_unlocked(iov[i].base, 1, iov[i].len, out);
+
+            count += put;
+
+            if (put < iov[i].len)
+                break;
+        }
+
+        return count;
+    }
+
+    if (bytes < room && !(out->flag & _NBF)) {
+        for (i = 0; i < n; ++i) {
+            write_buffered(out, (const char*)iov[i].base, iov[i].len);
+
+            if (out->flag & _LBF && !newline)
+                newline = memchr(iov[i].base, '\n', iov[i].len) != NULL;
+        }
+
+        /* Flush if a newline was written */
+        if (newline && !flushbuf(out))
+            return 0;
+
+        return bytes;
+    }
+
+    /* Memory and custom streams have no handle to gather on, so the blocks go to the device one by one */
+    if (out->flag & _NOHANDLE) {
+        size_t count = 0;
+
+        if (!flushbuf(out))
+            return 0;
+
+        for (i = 0; i < n; ++i) {
+            nwritten = device_write(out, iov[i].base, iov[i].len);
+
+            if (nwritten >= 0) {
+                out->pos += nwritten;
+                count += nwritten;
+            }
+
+            /* There was a stream error (or a full memory stream took only part of it) */
+            if (nwritten != (int)iov[i].len) {
+                out->flag |= _ERR;
+                break;
+            }
+        }
+
+        return count;
+    }
+
+    if (n + 1 > _IOVLOCAL && !(v = (struct _sys_iovec*)_sys_alloc((n + 1) * sizeof *v))) {
+        out->flag |= _ERR;
+        return 0;
+    }
+
+    /* Whatever is already buffered goes first */
+    if ((buffered = out->end - out->begin) > 0) {
+        v[nv].base = out->begin;
+        v[nv++].len = buffered;
+    }
+
+    memcpy(&v[nv], iov, n * sizeof *v);
+    nv += n;
+    pcache_drop(out);
+
+    if ((nwritten = _sys_writev(out->fd, v, nv)) < 0) {
+        out->flag |= _ERR;
+        bytes = 0;
+    }
+    else {
+        out->pos += nwritten;
+
+        /* Only part of it went out, and the buffered data was first in line */
+        if ((size_t)nwritten < buffered + bytes) {
+            out->flag |= _ERR;
+            bytes = (size_t)nwritten > buffered ? nwritten - buffered : 0;
+        }
+    }
+
+    out->begin = out->end = out->base;
+
+    if (v != local)
+        _sys_free(v);
+
+    return bytes;
+}
+
+/*
+    @description:
+        Copies up to n characters from src to dst (both locked and in the
+        right mode) for _fcopy.
+*/
+size_t copy_stream(FILE *dst, FILE *src, size_t n)
+{
+    size_t count = 0;
+    char *block;
+
+    /* Reset the source to read mode */
+    src->flag &= ~_WRITE;
+    src->flag |= _READ;
+
+    /* Pushed back and buffered characters are delivered first, through the usual path */
+    while (count < n && src->nunget > 0) {
+        char ch = src->unget[--src->nunget];
+
+        if (fwrite_unlocked(&ch, 1, 1, dst) != 1)
+            return count;
+
+        ++count;
+    }
+
+    if (count < n && src->begin != src->end) {
+        size_t avail = src->end - src->begin;
+        size_t put;
+
+        if (avail > n - count)
+            avail = n - count;
+
+        put = fwrite_unlocked(src->begin, 1, avail, dst);
+        src->begin += put;
+        count += put;
+
+        if (put < avail)
+            return count;
+    }
+
+    /*
+        Both files are now at the right position for the rest, which the
+        system can copy if neither side has to see the data on the way.
+    */
+    if (count < n && !((src->flag | dst->flag) & (_TEXT | _ASYNC | _LOG | _NOHANDLE)) && syncbuf(dst)) {
+        pcache_drop(dst);
+
+        while (count < n) {
+            int moved = _sys_copy(dst->fd, src->fd, n - count < _COPYMAX ? (int)(n - count) : _COPYMAX);
+
+            if (moved <= 0) {
+                if (moved == 0)
+                    src->flag |= _EOF;
+
+                break;
+            }
+
+            src->pos += moved;
+            dst->pos += moved;
+            count += moved;
+        }
+    }
+
+    /* Whatever the system couldn't do goes through memory in large blocks */
+    if (count < n && !(src->flag & (_EOF | _ERR)) && (block = (char*)_sys_alloc(_COPYSIZ)) != NULL) {
+        while (count < n) {
+            size_t want = n - count < _COPYSIZ ? n - count : _COPYSIZ;
+            size_t got = fread_unlocked(block, 1, want, src);
+            size_t put = fwrite_unlocked(block, 1, got, dst);
+
+            count += put;
+
+            if (got < want || put < got)
+                break;
+        }
+
+        _sys_free(block);
+    }
+
+    return count;
+}
+
+/*
+    @description:
+        Gets the current file position indicator for the specified stream.
+*/
+bool intern_tell(FILE *stream, fpos_t *new_pos)
+{
+    /* Records in a log ring aren't counted, so send them on first */
+    if (stream->flag & _LOG && !log_flush(stream)) {
+        errno = EGETP;
+        return false;
+    }
+
+    /* A transfer in flight would move the system position under us */
+    if (stream->flag & _ASYNC)
+        async_settle(stream);
+
+    /*
+        The system position is only asked for once, after that every read,
+        write and seek keeps it up to date. Appends, log drains and async
+        transfers move it where we can't follow, so those always ask.
+    */
+    if (!(stream->flag & _POS)) {
+        /* The system layer reports failure as nonzero */
+        if (_sys_tell(stream->fd, &stream->pos)) {
+            errno = EGETP;
+            return false;
+        }
+
+        if (!(stream->flag & _UNTRACKED))
+            stream->flag |= _POS;
+    }
+
+    /* Buffered output is still to be written, buffered input was read ahead */
+    if (stream->flag & _WRITE)
+        *new_pos = stream->pos + (stream->end - stream->begin);
+    else
+        *new_pos = stream->pos - count_buffer_bytes(stream);
+
+    /* So was a peeked character */
+    if (stream->flag & _PEEK)
+        --*new_pos;
+
+    /* And a block that was read ahead */
+    if (stream->flag & _ASYNC && stream->async->ready && stream->async->result > 0)
+        *new_pos -= stream->async->result;
+
+    return true;
+}
+
+/*
+    @description:
+        Sets the current file position indicator for the specified stream.
+*/
+bool intern_seek(FILE *stream, fpos_t offset, int whence)
+{
+    /*
+        SEEK_CUR is a pain, especially with padding and text expansion.
+        Ignore it completely and work from SEEK_SET instead.
+    */
+    if (whence == SEEK_CUR) {
+        fpos_t curr;
+
+        if (!intern_tell(stream, &curr)) {
+            errno = ESETP;
+            return false;
+        }
+
+        offset += curr;
+        whence = SEEK_SET;
+    }
+
+    /* Flush output streams in write mode, discard otherwise */
+    if (stream->flag & _WRITE)
+        flushbuf(stream);
+    else if (stream->flag & _MAP)
+        unmapbuf(stream);
+    else
+        stream->begin = stream->end = stream->base;
+
+    stream->mark = NULL;
+
+    /* The write behind has to land first, and a block read ahead is for the old position */
+    if (stream->flag & _ASYNC) {
+        async_settle(stream);
+        stream->async->ready = false;
+    }
+
+    /* Clear the unget buffer */
+    stream->nunget = 0;
+
+    /* The next operation may be a read or a write (log streams only ever write) */
+    if (!(stream->flag & _LOG))
+        stream->flag &= ~(_READ | _WRITE);
+
+    stream->flag &= ~_EOF;
+
+    if (!device_seek(stream, offset, whence)) {
+        errno = ESETP;
+        return false;
+    }
+
+    return true;
+}
+
+/*
+    @description:
+        Peeks ahead by one character in the source device.
+*/
+int peekbuf(FILE *in)
+{
+    if (device_read(in, &in->peek, 1) < 1)
+        return EOF;
+
+    in->pos += 1;
+    in->flag |= _PEEK;
+
+    return in->peek;
+}
+
+/*
+    @description:
+        Fills the buffer with characters from the source device.
+*/
+bool fillbuf(FILE *in)
+{
+    int has_peek = (in->flag & _PEEK) != 0;
+    int nread;
+
+    /* Mapped streams have nothing to copy, the window just moves */
+    if (in->flag & _MAP)
+        return mapbuf(in);
+
+    if (in->flag & _ASYNC)
+        return async_fill(in);
+
+    /* The last fill was consumed whole, so this looks like a sequential read */
+    if (in->end == in->base + in->size)
+        growbuf(in);
+
+    /* Grab the peeked character if present */
+    if (has_peek) {
+        in->base[0] = in->peek;
+        in->flag &= ~_PEEK;
+    }
+
+    /*
+        Fill the buffer directly from the system stream, taking care
+        not to overwrite or over read due to a peeked character.
+    */
+    nread = device_read(in, in->base + has_peek, in->size - has_peek);
+
+    if (nread < 0)
+        in->flag |= _ERR; /* There was a stream error */
+    else if (nread == 0 && !has_peek)
+        in->flag |= _EOF; /* We hit end-of-file immediately */
+    else {
+        in->pos += nread;
+        nread += has_peek; /* Account for a peeked character */
+
+        /* Finalize the buffer by compacting newlines in place */
+        if (in->flag & _TEXT)
+            nread = compact_newlines(in, in->base, nread);
+
+        in->begin = in->base;
+        in->end = in->base + nread;
+        in->mark = NULL;
+    }
+
+    return (in->flag & (_ERR | _EOF)) == 0;
+}
+
+/*
+    @description:
+        Sends buffered characters to the destination device.
+*/
+bool flushbuf(FILE *out)
+{
+    bool full = out->end == out->base + out->size;
+
+    if (out->flag & _LOG)
+        return log_flush(out);
+
+    if (out->flag & _ASYNC)
+        return async_flush(out);
+
+    /* Text streams were expanded on the way in, so the buffer is written as-is */
+    if (out->begin != out->end) {
+        int nwritten = device_write(out, out->begin, out->end - out->begin);
+
+        if (nwritten >= 0)
+            out->pos += nwritten;
+
+        /* There was a stream error (or a full memory stream took only part of it) */
+        if (nwritten != out->end - out->begin)
+            out->flag |= _ERR;
+    }
+
+    /* Reset the buffer so that we neither double flush nor overrun it after an error */
+    out->begin = out->end = out->base;
+
+    /* Flushing a full buffer means the stream is being written sequentially */
+    if (full)
+        growbuf(out);
+
+    return (out->flag & _ERR) == 0;
+}
+
+/*
+    @description:
+        Doubles the (empty) buffer of a growing stream, up to _BUFMAX.
+        Failing to grow isn't an error, the old buffer just stays.
+*/
+void growbuf(FILE *stream)
+{
+    if (stream->flag & _GROW && stream->flag & _OWNED && stream->size < _BUFMAX) {
+        char *buf = (char*)_sys_alloc(stream->size * 2);
+
+        if (buf) {
+            _sys_free(stream->base);
+            stream->base = stream->begin = stream->end = buf;
+            stream->size *= 2;
+        }
+    }
+}
+
+/*
+    @description:
+        Slides the mapping window of a mapped stream to the current file position.
+*/
+bool mapbuf(FILE *in)
+{
+    fpos_t pos, size, offset;
+    size_t len;
+
+    unmapbuf(in);
+
+    if (_sys_tell(in->fd, &pos) || _sys_filesize(in->fd, &size))
+        in->flag |= _ERR;
+    else if (pos >= size)
+        in->flag |= _EOF;
+    else {
+        /* The window has to start on a boundary the system can map */
+        offset = pos & ~(fpos_t)(_SYS_MAPALIGN - 1);
+        len = size - offset < _MAPSIZ ? (size_t)(size - offset) : _MAPSIZ;
+
+        if (!(in->base = (char*)_sys_map(in->fd, offset, len)))
+            in->flag |= _ERR;
+        else {
+            in->begin = in->base + (size_t)(pos - offset);
+            in->end = in->base + len;
+            in->size = len;
+
+            /* Park the system position just past the window so ftell and fseek work unchanged */
+            if (_sys_seek(in->fd, offset + len, SEEK_SET))
+                in->flag |= _ERR;
+
+            in->pos = offset + len;
+        }
+    }
+
+    return (in->flag & (_ERR | _EOF)) == 0;
+}
+
+/*
+    @description:
+        Releases the mapping window of a mapped stream, if any.
+*/
+void unmapbuf(FILE *stream)
+{
+    if (stream->base)
+        _sys_unmap(stream->base, stream->size);
+
+    stream->base = stream->begin = stream->end = NULL;
+    stream->size = 0;
+}
+
+/*
+    @description:
+        Converts a platform-dependent line break sequence into '\n'.
+*/
+size_t compact_newlines(FILE *in, char *buf, size_t n)
+{
+    char *end = &buf[n];
+    char *it = &buf[_memscan(buf, '\r', n)];
+    char *save = it; /* Nothing before the first CR needs to move */
+
+    while (it != end) {
+        size_t span;
+
+        /* Compact CRLF into LF (it always points to a CR here) */
+        if (&it[1] == end) {
+            /*
+                CR at the end of the buffer should be relatively rare, 
+                so we can  comfortably peek on a per character basis.
+            */
+
+            /* If we couldn't peek, CR will be saved */
+            if (peekbuf(in) == '\n') {
+                /* We found LF; overwrite the CR so that LF is saved */
+                *it = '\n';
+
+                /* Reset the peek status so the extra LF is discarded */
+                in->flag &= ~_PEEK;
+            }
+        }
+        else if (it[1] == '\n') {
+            ++it; /* The next character is LF so jump over the CR and continue */
+        }
+
+        *save++ = *it++;
+
+        /* Everything up to the next CR moves down as one block */
+        span = _memscan(it, '\r', end - it);
+
+        if (save != it)
+            memmove(save, it, span);
+
+        save += span;
+        it += span;
+    }
+
+    return save - buf;
+}
+
+/*
+    @description:
+        Copies up to n characters from src into the stream's buffer,
+        converting '\n' into a suitable platform-dependent line break 
+        sequence. Returns the number of characters consumed from src.
+*/
+size_t expand_newlines(FILE *out, const char *src, size_t n)
+{
+    const char *it = src;
+    const char *end = &src[n];
+    char *limit = out->base + out->size;
+
+    while (it != end && out->end != limit) {
+        size_t room = limit - out->end;
+        size_t span = (size_t)(end - it) < room ? (size_t)(end - it) : room;
+
+        /* Everything up to the next LF is copied as one block */
+        span = _memscan(it, '\n', span);
+        memcpy(out->end, it, span);
+        out->end += span;
+        it += span;
+
+        /* Stopping short of both limits means it points to an LF */
+        if (it != end && out->end != limit) {
+            /* Expand LF into CRLF, leaving it for the next flush if both don't fit */
+            if (limit - out->end < 2)
+                break;
+
+            *out->end++ = '\r';
+            *out->end++ = *it++;
+        }
+    }
+
+    return it - src;
+}
+
+/*
+    @description:
+        Makes the shared state for a log stream with a buffer of size bytes.
+*/
+struct _log *log_start(size_t size)
+{
+    struct _log *log = (struct _log*)_sys_alloc(sizeof *log);
+
+    if (log) {
+        memset(log, 0, sizeof *log);
+        log->span = size / _LOGSEGS;
+    }
+
+    return log;
+}
+
+/*
+    @description:
+        Appends one record, gathered from n blocks, to a log stream
+        without taking the stream lock (unless a segment fills up).
+*/
+bool log_append(FILE *out, const struct _sys_iovec *rec, int n)
+{
+    struct _log *log = out->log;
+    bool text = (out->flag & _TEXT) != 0;
+    size_t len = 0;
+    int i;
+
+    /* Text streams store the device's line breaks, which take a byte more each */
+    for (i = 0; i < n; ++i)
+        len += rec[i].len + (text ? _memcount((const char*)rec[i].base, '\n', rec[i].len) : 0);
+
+    if (len > log->span) {
+        /* A record that no segment can hold goes straight out, after everything before it */
+        char *buf = (char*)_sys_alloc(len);
+        bool ok;
+
+        if (!buf) {
+            out->flag |= _ERR;
+            return false;
+        }
+
+        copy_record(buf, rec, n, text);
+        flockfile(out);
+        pcache_drop(out);
+
+        if ((ok = log_flush(out)) && _sys_write(out->fd, buf, len) != (int)len) {
+            out->flag |= _ERR;
+            ok = false;
+        }
+
+        funlockfile(out);
+        _sys_free(buf);
+
+        return ok;
+    }
+
+    for (;;) {
+        unsigned seq = log->head;
+        unsigned slot = seq % _LOGSEGS;
+        unsigned off = _atomic_add(&log->seg[slot].used, len);
+
+        if (off + len <= log->span) {
+            copy_record(out->base + slot * log->span + off, rec, n, text);
+            _atomic_add(&log->seg[slot].done, len);
+
+            return true;
+        }
+
+        if (off <= log->span) {
+            /* This record is the first one that didn't fit, so the segment is ours to seal */
+            if (!log_seal(out, slot, off))
+                return false;
+        }
+        else {
+            /* Someone else is sealing the segment, so wait for the next one */
+            while (log->head == seq)
+                log_yield(out);
+        }
+    }
+}
+
+/*
+    @description:
+        Formats a record for a log stream and appends it in one piece.
+*/
+int log_printf(FILE *out, const char *fmt, va_list args)
+{
+    char buf[_LOGRECSIZ];
+    struct _sys_iovec rec;
+    va_list copy;
+    int rv;
+
+    va_copy(copy, args);
+    rv = vsnprintf(buf, sizeof buf, fmt, args);
+
+    rec.base = buf;
+    rec.len = rv;
+
+    /* Long records are formatted again into a buffer that fits */
+    if (rv >= 0 && rec.len >= sizeof buf) {
+        if ((rec.base = _sys_alloc(rec.len + 1)) != NULL)
+            vsnprintf((char*)rec.base, rec.len + 1, fmt, copy);
+        else {
+            out->flag |= _ERR;
+            rv = -1;
+        }
+    }
+
+    va_end(copy);
+
+    if (rv < 0)
+        return rv;
+
+    if (!log_append(out, &rec, 1))
+        rv = -1;
+
+    if (rec.base != buf)
+        _sys_free(rec.base);
+
+    return rv;
+}
+
+/*
+    @description:
+        Seals the segment in slot at off bytes, moves writers on to
+        the next segment, and writes out the sealed segments if the
+        stream lock is free.
+*/
+bool log_seal(FILE *out, unsigned slot, unsigned off)
+{
+    struct _log *log = out->log;
+    unsigned seq = log->seg[slot].seq;
+    unsigned next = (seq + 1) % _LOGSEGS;
+    bool ok = true;
+
+    log->seg[slot].sealed = off;
+
+    /* A writer that read a stale head can fill a segment before it's made current */
+    while (log->head != seq)
+        log_yield(out);
+
+    /* The next segment can't be reused until it's been written out */
+    while (seq + 1 - log->tail >= _LOGSEGS)
+        log_yield(out);
+
+    log->seg[next].seq = seq + 1;
+    log->seg[next].done = 0;
+    log->seg[next].sealed = 0;
+    log->seg[next].used = 0;
+    log->head = seq + 1;
+
+    /*
+        Write out the sealed segments unless another thread holds the lock.
+        If it does, it checks again after unlocking (by this same loop).
+    */
+    while (log->tail != log->head && ftrylockfile(out) == 0) {
+        ok = log_drain(out) && ok;
+        funlockfile(out);
+    }
+
+    return ok;
+}
+
+/*
+    @description:
+        Writes out everything appended to a log stream so far. The
+        caller is responsible for holding the stream lock.
+*/
+bool log_flush(FILE *out)
+{
+    struct _log *log = out->log;
+    unsigned seq = log->head;
+    unsigned slot = seq % _LOGSEGS;
+
+    if (log->seg[slot].used != 0) {
+        /* Seal the current segment by reserving more than it could ever hold */
+        unsigned off = _atomic_add(&log->seg[slot].used, log->span + 1);
+
+        if (off <= log->span)
+            log_seal(out, slot, off);
+        else {
+            while (log->head == seq)
+                log_yield(out);
+        }
+    }
+
+    return log_drain(out);
+}
+
+/*
+    @description:
+        Writes every sealed segment of a log stream with one vectored
+        write. The caller is responsible for holding the stream lock.
+*/
+bool log_drain(FILE *out)
+{
+    struct _log *log = out->log;
+    struct _sys_iovec iov[_LOGSEGS];
+    unsigned head = log->head;
+    unsigned seq;
+    size_t total = 0;
+    int n = 0;
+
+    for (seq = log->tail; seq != head; ++seq) {
+        unsigned slot = seq % _LOGSEGS;
+
+        /* Writers that reserved room before the seal may still be copying */
+        while (log->seg[slot].done != log->seg[slot].sealed)
+            _sys_yield();
+
+        iov[n].base = out->base + slot * log->span;
+        iov[n++].len = log->seg[slot].sealed;
+        total += log->seg[slot].sealed;
+    }
+
+    if (n > 0) {
+        pcache_drop(out);
+
+        /* A short write loses the end of a record, so it's as much an error as a failed one */
+        if (_sys_writev(out->fd, iov, n) != (int)total)
+            out->flag |= _ERR;
+    }
+
+    /* The segments are free again even after an error so writers never stall */
+    log->tail = head;
+
+    return (out->flag & _ERR) == 0;
+}
+
+/*
+    @description:
+        Waits a moment for another writer to move a log stream along.
+        A full ring is drained here if the lock is free (or already
+        held by the caller), since that's what the writer may be
+        waiting for.
+*/
+void log_yield(FILE *out)
+{
+    struct _log *log = out->log;
+
+    if (log->head - log->tail >= _LOGSEGS - 1 && ftrylockfile(out) == 0) {
+        log_drain(out);
+        funlockfile(out);
+    }
+    else {
+        _sys_yield();
+    }
+}
+
+/*
+    @description:
+        Copies the n blocks of a record to dst, expanding '\n' into
+        CRLF for text streams.
+*/
+void copy_record(char *dst, const struct _sys_iovec *rec, int n, bool text)
+{
+    for (; n > 0; --n, ++rec) {
+        const char *it = (const char*)rec->base;
+        const char *end = it + rec->len;
+
+        while (it != end) {
+            size_t span = text ? _memscan(it, '\n', end - it) : (size_t)(end - it);
+
+            memcpy(dst, it, span);
+            dst += span;
+            it += span;
+
+            if (it != end) {
+                *dst++ = '\r';
+                *dst++ = *it++;
+            }
+        }
+    }
+}
+
+/*
+    @description:
+        Loads the window of the file holding pos into the stream's
+        positional read cache, making the cache if needed. The window
+        starts on a multiple of its size unless the want bytes at pos
+        would run off its end.
+*/
+bool pcache_fill(FILE *in, fpos_t pos, size_t want)
+{
+    struct _pcache *cache = in->pcache;
+    fpos_t start = pos - pos % _PCACHESIZ;
+    int nread;
+
+    if (!cache) {
+        if (!(cache = (struct _pcache*)_sys_alloc(sizeof *cache)))
+            return false;
+
+        in->pcache = cache;
+    }
+
+    if (pos + (fpos_t)want > start + _PCACHESIZ)
+        start = pos;
+
+    if ((nread = _sys_pread(in->fd, cache->buf, _PCACHESIZ, start)) < 0) {
+        in->flag |= _ERR;
+        cache->len = 0;
+        return false;
+    }
+
+    cache->off = start;
+    cache->len = nread;
+
+    return true;
+}
+
+/*
+    @description:
+        Empties the positional read cache of a stream (if it has one)
+        before the file behind it is written.
+*/
+void pcache_drop(FILE *stream)
+{
+    if (stream->pcache)
+        stream->pcache->len = 0;
+}
+
+/*
+    @description:
+        Flushes the buffer and waits until the data has really been
+        handed to the system (flushbuf only starts the write on async
+        streams).
+*/
+bool syncbuf(FILE *out)
+{
+    if (!flushbuf(out))
+        return false;
+
+    return out->flag & _ASYNC ? async_settle(out) : true;
+}
+
+/*
+    @description:
+        Makes the spare buffer and worker thread for an async stream
+        with a buffer of size bytes.
+*/
+struct _async *async_start(FILE *stream, size_t size)
+{
+    struct _async *io = (struct _async*)_sys_alloc(sizeof *io);
+
+    if (!io)
+        return NULL;
+
+    memset(io, 0, sizeof *io);
+    io->fd = stream->fd;
+
+    if (!(io->spare = (char*)_sys_alloc(size))) {
+        _sys_free(io);
+        return NULL;
+    }
+
+    /* The worker just sleeps until the first transfer is posted */
+    if ((io->worker = _sys_thread_create(async_worker, io)) == _SYS_BADHANDLE) {
+        _sys_free(io->spare);
+        _sys_free(io);
+        return NULL;
+    }
+
+    return io;
+}
+
+/*
+    @description:
+        Refills an async stream's buffer from the block read ahead,
+        and starts reading the next block in the background.
+*/
+bool async_fill(FILE *in)
+{
+    struct _async *io = in->async;
+
+    async_settle(in);
+
+    /* Nothing was read ahead (the first fill, or the first after a seek) */
+    if (!io->ready) {
+        async_post(in, false, io->spare, in->size);
+        async_settle(in);
+    }
+
+    io->ready = false;
+
+    if (io->result < 0)
+        in->flag |= _ERR; /* There was a stream error */
+    else if (io->result == 0)
+        in->flag |= _EOF; /* We hit end-of-file */
+    else {
+        char *buf = in->base;
+
+        /* Trade buffers and get going on the next block right away */
+        in->base = io->spare;
+        in->begin = in->base;
+        in->end = in->base + io->result;
+        io->spare = buf;
+
+        async_post(in, false, io->spare, in->size);
+    }
+
+    return (in->flag & (_ERR | _EOF)) == 0;
+}
+
+/*
+    @description:
+        Hands an async stream's buffer to the worker to write, and
+        continues in the spare buffer. Errors surface on a later call.
+*/
+bool async_flush(FILE *out)
+{
+    struct _async *io = out->async;
+
+    /* The previous write has to finish before its buffer is reused */
+    async_settle(out);
+
+    if (out->begin != out->end) {
+        char *buf = out->base;
+
+        pcache_drop(out);
+        async_post(out, true, out->begin, out->end - out->begin);
+        out->base = io->spare;
+        io->spare = buf;
+    }
+
+    out->begin = out->end = out->base;
+
+    return (out->flag & _ERR) == 0;
+}
+
+/*
+    @description:
+        Gives the worker of an async stream a transfer to do.
+*/
+void async_post(FILE *stream, bool write, char *buf, int len)
+{
+    struct _async *io = stream->async;
+
+    io->write = write;
+    io->buf = buf;
+    io->len = len;
+
+    _atomic_swap(&io->state, _ASYNC_POSTED);
+    _sys_wake(&io->state, 1);
+}
+
+/*
+    @description:
+        Waits for the transfer in flight (if any) on an async stream and
+        collects its result. A failed write marks the stream's error.
+*/
+bool async_settle(FILE *stream)
+{
+    struct _async *io = stream->async;
+    int state;
+
+    while ((state = io->state) == _ASYNC_POSTED)
+        _sys_wait(&io->state, state);
+
+    if (state == _ASYNC_DONE) {
+        _atomic_swap(&io->state, _ASYNC_IDLE);
+
+        if (!io->write)
+            io->ready = true;
+        else if (io->result < 0)
+            stream->flag |= _ERR;
+    }
+
+    return (stream->flag & _ERR) == 0;
+}
+
+/*
+    @description:
+        Stops the worker of an async stream once it's idle, hands the
+        stream back its own buffer, and releases the rest.
+*/
+void async_stop(FILE *stream)
+{
+    struct _async *io = stream->async;
+
+    async_settle(stream);
+    _atomic_swap(&io->state, _ASYNC_EXIT);
+    _sys_wake(&io->state, 1);
+    _sys_thread_join(io->worker);
+
+    if (stream->base != io->home) {
+        io->spare = stream->base;
+        stream->base = stream->begin = stream->end = io->home;
+    }
+
+    _sys_free(io->spare);
+    _sys_free(io);
+    stream->async = NULL;
+}
+
+/*
+    @description:
+        Body of an async stream's worker thread. Does one posted transfer
+        at a time until told to exit.
+*/
+void async_worker(void *arg)
+{
+    struct _async *io = (struct _async*)arg;
+    int state;
+
+    for (;;) {
+        while ((state = io->state) != _ASYNC_POSTED && state != _ASYNC_EXIT)
+            _sys_wait(&io->state, state);
+
+        if (state == _ASYNC_EXIT)
+            break;
+
+        if (io->write)
+            io->result = _sys_write(io->fd, io->buf, io->len);
+        else
+            io->result = _sys_read(io->fd, io->buf, io->len);
+
+        _atomic_swap(&io->state, _ASYNC_DONE);
+        _sys_wake(&io->state, 1);
+    }
+}
+
+/*
+    @description:
+        Reads up to n characters from the file (or memory) behind the
+        stream, at its system file position, which is left to the caller
+        to advance.
+*/
+int device_read(FILE *in, void *dst, int n)
+{
+    struct _mem *mem = in->mem;
+    size_t avail;
+
+    if (in->flag & _COOKIE) {
+        struct _cookie *dev = in->cookie;
+
+        if (!dev->read)
+            return -1;
+
+        /* Without a read callback the stream is always at end-of-file */
+        return dev->io.read ? (int)dev->io.read(dev->cookie, (char*)dst, n) : 0;
+    }
+
+    if (!(in->flag & _MEM))
+        return _sys_read(in->fd, dst, n);
+
+    if (!mem->read)
+        return -1;
+
+    avail = in->pos < (fpos_t)mem->len ? mem->len - (size_t)in->pos : 0;
+
+    if ((size_t)n > avail)
+        n = avail;
+
+    memcpy(dst, mem->buf + (size_t)in->pos, n);
+
+    return n;
+}
+
+/*
+    @description:
+        Writes n characters to the file (or memory) behind the stream,
+        at its system file position, which is left to the caller to
+        advance. A fixed memory stream writes only what fits.
+*/
+int device_write(FILE *out, const void *src, int n)
+{
+    struct _mem *mem = out->mem;
+    size_t pos, end;
+
+    /* Whatever _fpread kept of the file may be about to change */
+    pcache_drop(out);
+
+    if (out->flag & _COOKIE) {
+        struct _cookie *dev = out->cookie;
+        int nwritten = 0;
+
+        if (!dev->write)
+            return -1;
+
+        /* Without a write callback the output is thrown away */
+        if (!dev->io.write)
+            return n;
+
+        /* Like pipes, a callback may take less than everything, so keep going */
+        while (nwritten < n) {
+            ssize_t rc = dev->io.write(dev->cookie, (const char*)src + nwritten, n - nwritten);
+
+            if (rc <= 0)
+                return nwritten > 0 ? nwritten : -1;
+
+            nwritten += rc;
+        }
+
+        return nwritten;
+    }
+
+    if (!(out->flag & _MEM))
+        return _sys_write(out->fd, (void*)src, n);
+
+    if (!mem->write)
+        return -1;
+
+    if (mem->append)
+        out->pos = mem->len;
+
+    pos = (size_t)out->pos;
+    end = pos + n;
+
+    /* A temporary file that gets too big for memory carries on as a real file */
+    if (mem->spill && end > mem->spill && mem_spill(out))
+        return _sys_write(out->fd, (void*)src, n);
+
+    if (mem->grow) {
+        if (!mem_reserve(mem, end))
+            return -1;
+    }
+    else if (end > mem->size) {
+        if (pos >= mem->size)
+            return -1;
+
+        end = mem->size;
+        n = end - pos;
+    }
+
+    /* Seeking past the end leaves a gap that reads back as zeros */
+    if (pos > mem->len)
+        memset(mem->buf + mem->len, 0, pos - mem->len);
+
+    memcpy(mem->buf + pos, src, n);
+
+    if (end > mem->len) {
+        mem->len = end;
+
+        /* Keep the data terminated where there's room (open_memstream always makes room) */
+        if (end < mem->size)
+            mem->buf[end] = '\0';
+    }
+
+    if (mem->ptr)
+        *mem->sizeloc = end;
+
+    return n;
+}
+
+/*
+    @description:
+        Moves the position of the file (or memory, or custom device)
+        behind the stream, keeping track of it where possible.
+*/
+bool device_seek(FILE *stream, fpos_t offset, int whence)
+{
+    if (stream->flag & _MEM)
+        return mem_seek(stream, offset, whence);
+
+    if (stream->flag & _COOKIE) {
+        struct _cookie *dev = stream->cookie;
+
+        /* The callback reports where it ended up */
+        if (!dev->io.seek || dev->io.seek(dev->cookie, &offset, whence) != 0)
+            return false;
+
+        stream->pos = offset;
+
+        return true;
+    }
+
+    if (_sys_seek(stream->fd, offset, whence)) {
+        stream->flag &= ~_POS;
+        return false;
+    }
+
+    /* Seeking from the end needs the file size, so leave that to the next tell */
+    if (whence == SEEK_SET && !(stream->flag & _UNTRACKED)) {
+        stream->pos = offset;
+        stream->flag |= _POS;
+    }
+    else
+        stream->flag &= ~_POS;
+
+    return true;
+}
+
+/*
+    @description:
+        Makes a stream in the handle pool for a device without a system
+        handle. kind is _MEM or _COOKIE, and the size bytes at init are
+        copied into the device state, which the stream then owns. The
+        device starts at pos.
+*/
+FILE *device_open(struct file_pool *pool, unsigned kind, const void *init, size_t size, fpos_t pos)
+{
+    FILE *stream = get_unused_handle(pool);
+    void *dev;
+    char *buf;
+
+    if (!stream)
+        return NULL;
+
+    dev = _sys_alloc(size);
+    buf = (char*)_sys_alloc(BUFSIZ);
+
+    if (!dev || !buf) {
+        _sys_free(dev);
+        _sys_free(buf);
+        release_handle(stream);
+        return NULL;
+    }
+
+    memcpy(dev, init, size);
+
+    if (kind == _MEM)
+        stream->mem = (struct _mem*)dev;
+    else
+        stream->cookie = (struct _cookie*)dev;
+
+    /* The position is always known, nothing else can move it behind our back */
+    stream->fd = _SYS_BADHANDLE;
+    stream->base = stream->begin = stream->end = buf;
+    stream->mark = NULL;
+    stream->size = BUFSIZ;
+    stream->nunget = 0;
+    stream->pos = pos;
+    stream->flag = _OWNED | kind | _OPEN | _POS;
+    link_stream(stream);
+
+    return stream;
+}
+
+/*
+    @description:
+        Moves the data of a memory stream from tmpfile into a new temporary
+        file, which the stream then uses from its current position on. The
+        stream stays in memory if the file can't be made.
+*/
+bool mem_spill(FILE *stream)
+{
+    struct _mem *mem = stream->mem;
+    char *name = (char*)_sys_alloc(L_tmpnam);
+    int orient, attr, share;
+    unsigned flag = 0;
+    _sys_handle_t fd;
+
+    if (!name || !get_temp_name(name) || !_sys_parse_openmode("rb+", &flag, &orient, &attr, &share) ||
+        (fd = _sys_openfile(name, orient, attr, share)) == _SYS_BADHANDLE)
+    {
+        _sys_free(name);
+        return false;
+    }
+
+    if ((mem->len > 0 && _sys_write(fd, mem->buf, mem->len) < 0) || _sys_seek(fd, stream->pos, SEEK_SET)) {
+        _sys_closefile(fd);
+        remove(name);
+        _sys_free(name);
+        return false;
+    }
+
+    free(mem->buf);
+    _sys_free(mem);
+
+    /* The position carries over, so it's still tracked */
+    stream->mem = NULL;
+    stream->fd = fd;
+    stream->tmp = name;
+    stream->flag = (stream->flag & ~_MEM) | _TEMP;
+
+    return true;
+}
+
+/*
+    @description:
+        Makes sure the stream has a system handle, moving an in-memory
+        tmpfile to a real file first. Other memory streams and custom
+        streams never have one.
+*/
+bool ensure_handle(FILE *stream)
+{
+    if (stream->flag & _MEM && stream->mem->spill)
+        return mem_spill(stream);
+
+    return !(stream->flag & _NOHANDLE);
+}
+
+/*
+    @description:
+        Parses an fopen mode for a stream without a file, where text and
+        binary are the same thing.
+*/
+bool parse_access(const char *mode, bool *read, bool *write, bool *append)
+{
+    *read = *write = *append = false;
+
+    switch (*mode) {
+    case 'r': *read = true; break;
+    case 'w': *write = true; break;
+    case 'a': *write = *append = true; break;
+    default:  return false;
+    }
+
+    while (*++mode) {
+        if (*mode == '+')
+            *read = *write = true;
+        else if (*mode != 'b')
+            return false;
+    }
+
+    return true;
+}
+
+/*
+    @description:
+        Grows the memory of a growing memory stream so that need bytes
+        and a null character fit, doubling it each time.
+*/
+bool mem_reserve(struct _mem *mem, size_t need)
+{
+    size_t size = mem->size ? mem->size : _MEMSIZ;
+    char *buf;
+
+    while (size < need + 1)
+        size *= 2;
+
+    if (size == mem->size)
+        return true;
+
+    if (!(buf = (char*)realloc(mem->buf, size)))
+        return false;
+
+    mem->buf = buf;
+    mem->size = size;
+
+    if (mem->ptr)
+        *mem->ptr = buf;
+
+    return true;
+}
+
+/*
+    @description:
+        Moves the position of a memory stream. A fixed stream can't go
+        past the end of its memory, a growing one can go anywhere.
+*/
+bool mem_seek(FILE *stream, fpos_t offset, int whence)
+{
+    struct _mem *mem = stream->mem;
+
+    if (whence == SEEK_END)
+        offset += mem->len;
+    else if (whence == SEEK_CUR)
+        offset += stream->pos;
+
+    if (offset < 0 || (!mem->grow && offset > (fpos_t)mem->size))
+        return false;
+
+    stream->pos = offset;
+
+    /* open_memstream reports the data up to the position */
+    if (mem->ptr)
+        *mem->sizeloc = offset < (fpos_t)mem->len ? (size_t)offset : mem->len;
+
+    return true;
 }
 
 /*
@@ -1089,14 +3720,14 @@ int write_stream(void *data, void *dst, size_t n, size_t *count, size_t limit)
     
     if (limit == (size_t)-1) {
         /* No limit, just write until done */
-        written = fwrite(data, 1, n, (FILE*)dst);
+        written = fwrite_unlocked(data, 1, n, (FILE*)dst);
     }
     else {
         /* Write up to the limit */
         size_t remaining = limit - *count;
         size_t safen = n < remaining ? n : remaining;
 
-        if (safen > 0 && (written = fwrite(data, 1, safen, (FILE*)dst)) == safen) {
+        if (safen > 0 && (written = fwrite_unlocked(data, 1, safen, (FILE*)dst)) == safen) {
             /* Trick the return value into reporting success */
             written = n;
         }
@@ -1153,7 +3784,7 @@ int write_nothing(void *data, void *dst, size_t n, size_t *count, size_t limit)
 */
 int read_stream(void *src, size_t *count)
 {
-    int rv = fgetc((FILE*)src);
+    int rv = getc_unlocked((FILE*)src);
 
     if (rv != EOF)
         ++(*count);
@@ -1170,7 +3801,7 @@ int unget_stream(void *data, void *src, size_t *count)
     if (*(char*)data == EOF)
         return EOF;
     else {
-        int rv = ungetc(*(char*)data, (FILE*)src);
+        int rv = ungetc_unlocked(*(char*)data, (FILE*)src);
 
         if (rv != EOF)
             --(*count);
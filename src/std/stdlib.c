@@ -1,3 +1,4 @@
+#include "_malloc.h"
 #include "_rand.h"
 #include "_sort.h"
 #include "_system.h"
@@ -14,6 +15,24 @@
 
 #define _EXIT_FUNC_MAX 32 /* Minimum requirement */
 #define _BASE_MAX      36 /* Upper limit for integer conversions */
+#define _ARENA_CHUNK   65536 /* Default usable size of an arena chunk */
+#define _ARENA_MIN     1024 /* Smallest usable size of an arena chunk */
+#define _ARENA_ALIGN   16 /* Alignment of every arena allocation */
+
+/* Header of each block an arena hands out allocations from */
+struct arena_chunk {
+    struct arena_chunk *prev;   /* Chunk allocated before this one */
+    size_t              size;   /* Usable bytes after the header */
+    size_t              pad[2]; /* Keeps the data 16 byte aligned where the heap does */
+};
+
+struct _arena {
+    _sys_handle_t       heap;   /* Private heap holding the arena and all of its chunks */
+    struct arena_chunk *chunks; /* Every chunk, newest first */
+    char               *next;   /* Bump pointer into the current chunk */
+    char               *end;    /* End of the current chunk */
+    size_t              size;   /* Usable size of a regular chunk */
+};
 
 /* Registered exit function stacks */
 static _exitfunc_t qexit_funcs[_EXIT_FUNC_MAX];
@@ -34,6 +53,7 @@ static char *fpcvt(double value, int precision, int *radix, int *sign, char *buf
 static const char *integer_end(const char *first, const char *last, int base);
 static int max_digits(int bits, int base);
 static char *round_numeric(char *s);
+static struct arena_chunk *arena_chunk(struct _arena *arena, size_t size);
 
 /* 
     ===================================================
@@ -540,11 +560,10 @@ int system(const char *command)
     if (!command)
         return cmd_proc ? -1 : 0;
 
-    if (!cmd_proc) {
-        if (!(cmd_proc = _strdup(_SYS_CMDPROC))) {
-            errno = ENOMEM;
-            return -1;
-        }
+    /* getenv's result isn't ours to free, so always work with a copy */
+    if (!(cmd_proc = _strdup(cmd_proc ? cmd_proc : _SYS_CMDPROC))) {
+        errno = ENOMEM;
+        return -1;
     }
 
     /* Set up the full command line */
@@ -576,16 +595,11 @@ int system(const char *command)
 */
 void *aligned_alloc(size_t alignment, size_t size)
 {
-    uintptr_t mem;
-
-    if (!(mem = (uintptr_t)malloc(alignment + size)))
+    /* Only powers of two are valid alignments */
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0)
         return NULL;
 
-    mem += alignment - sizeof(size_t);
-    *(size_t*)mem = alignment; /* Custom alignment */
-    mem += sizeof(size_t);
-
-    return (void*)mem;
+    return _malloc_aligned(alignment, size);
 }
 
 /*
@@ -594,12 +608,7 @@ void *aligned_alloc(size_t alignment, size_t size)
 */
 void *malloc(size_t size)
 {
-    uintptr_t mem = (uintptr_t)_sys_heapalloc(__sys_heap, size + sizeof(size_t));
-
-    *(size_t*)mem = 0; /* General alignment */
-    mem += sizeof(size_t);
-
-    return (void*)mem;
+    return _malloc_alloc(size);
 }
 
 /*
@@ -609,7 +618,12 @@ void *malloc(size_t size)
 */
 void *calloc(size_t n, size_t size)
 {
-    void *mem = malloc(n * size);
+    void *mem;
+
+    if (size && n > (size_t)-1 / size)
+        return NULL;
+
+    mem = malloc(n * size);
 
     if (mem)
         memset(mem, 0, n * size);
@@ -642,19 +656,7 @@ void *realloc(void *p, size_t size)
     }
     else {
         /* p and size are valid, reallocate the memory with a new size */
-
-        /*
-            Take into account a pointer from aligned_alloc, but reallocate 
-            to general alignment because there's no aligned_realloc.
-        */
-        size_t align = ((size_t*)p)[-1];
-        uintptr_t old = (uintptr_t)p - (align + sizeof(size_t));
-        uintptr_t mem = (uintptr_t)_sys_heaprealloc(__sys_heap, (void*)old, size - align + sizeof(size_t));
-
-        *(size_t*)mem = 0; /* General alignment */
-        mem += sizeof(size_t);
-
-        return (void*)mem;
+        return _malloc_realloc(p, size);
     }
 }
 
@@ -664,12 +666,48 @@ void *realloc(void *p, size_t size)
 */
 void free(void *p)
 {
-    if (p) {
-        size_t align = ((size_t*)p)[-1];
-        uintptr_t old = (uintptr_t)p - (align + sizeof(size_t));
+    _malloc_free(p);
+}
 
-        _sys_heapfree(__sys_heap, (void*)old);
+/*
+    @description:
+        Allocates space for an object whose alignment is specified by
+        alignment and whose size is specified by size, storing it in *p.
+        Returns 0, or EINVAL for a bad alignment or ENOMEM on failure.
+*/
+int posix_memalign(void **p, size_t alignment, size_t size)
+{
+    void *mem;
+
+    if (alignment < sizeof(void*) || (alignment & (alignment - 1)) != 0)
+        return EINVAL;
+
+    if (!(mem = _malloc_aligned(alignment, size)))
+        return ENOMEM;
+
+    *p = mem;
+
+    return 0;
+}
+
+/*
+    @description:
+        Works like realloc, except that the new object keeps the
+        alignment specified by alignment when it has to move.
+*/
+void *_aligned_realloc(void *p, size_t size, size_t alignment)
+{
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0)
+        return NULL;
+
+    if (!p)
+        return _malloc_aligned(alignment, size);
+    else if (size == 0) {
+        free(p);
+        return NULL;
     }
+
+    return _malloc_realign(p, alignment, size);
 }
 
 /*
@@ -875,6 +913,114 @@ char *_fcvt(double value, int precision, int *radix, int *sign)
     return fpcvt(value, precision, radix, sign, cvtbuf, 0);
 }
 
+/*
+    @description:
+        Creates an arena that hands out memory from chunks of chunk_size
+        bytes (but no fewer than 1024), or a default size if chunk_size
+        is 0. Everything allocated from the arena is released at once by
+        _arena_reset or _arena_destroy.
+            * An arena isn't thread safe; give each thread its own.
+*/
+struct _arena *_arena_create(size_t chunk_size)
+{
+    _sys_handle_t heap = _sys_heapcreate();
+    struct _arena *arena;
+
+    if (!heap || heap == _SYS_BADHANDLE)
+        return NULL;
+
+    if (!(arena = (struct _arena*)_sys_heapalloc(heap, sizeof *arena))) {
+        _sys_heapdestroy(&heap);
+        return NULL;
+    }
+
+    arena->heap = heap;
+    arena->chunks = NULL;
+    arena->next = arena->end = NULL;
+    arena->size = !chunk_size ? _ARENA_CHUNK : chunk_size < _ARENA_MIN ? _ARENA_MIN : chunk_size;
+
+    return arena;
+}
+
+/*
+    @description:
+        Allocates size bytes from the arena, aligned for any object.
+        Returns NULL if a new chunk is needed and there's no memory for it.
+*/
+void *_arena_alloc(struct _arena *arena, size_t size)
+{
+    char *p = (char*)(((uintptr_t)arena->next + _ARENA_ALIGN - 1) & ~(uintptr_t)(_ARENA_ALIGN - 1));
+    struct arena_chunk *chunk;
+
+    if (arena->next && p <= arena->end && size <= (size_t)(arena->end - p)) {
+        arena->next = p + size;
+        return p;
+    }
+
+    /* Big requests get a chunk of their own, so the current one isn't abandoned half used */
+    if (size > arena->size / 4) {
+        if (size > (size_t)-1 - _ARENA_ALIGN || !(chunk = arena_chunk(arena, size + _ARENA_ALIGN - 1)))
+            return NULL;
+
+        return (void*)(((uintptr_t)(chunk + 1) + _ARENA_ALIGN - 1) & ~(uintptr_t)(_ARENA_ALIGN - 1));
+    }
+
+    if (!(chunk = arena_chunk(arena, arena->size)))
+        return NULL;
+
+    /* A quarter chunk always fits after aligning the start */
+    p = (char*)(((uintptr_t)(chunk + 1) + _ARENA_ALIGN - 1) & ~(uintptr_t)(_ARENA_ALIGN - 1));
+    arena->next = p + size;
+    arena->end = (char*)(chunk + 1) + chunk->size;
+
+    return p;
+}
+
+/*
+    @description:
+        Releases everything allocated from the arena, keeping one
+        regular chunk so the next round starts without a system call.
+*/
+void _arena_reset(struct _arena *arena)
+{
+    struct arena_chunk *keep = NULL;
+
+    while (arena->chunks) {
+        struct arena_chunk *chunk = arena->chunks;
+
+        arena->chunks = chunk->prev;
+
+        if (!keep && chunk->size == arena->size)
+            keep = chunk;
+        else
+            _sys_heapfree(arena->heap, chunk);
+    }
+
+    if ((arena->chunks = keep) != NULL) {
+        keep->prev = NULL;
+        arena->next = (char*)(keep + 1);
+        arena->end = arena->next + keep->size;
+    }
+    else {
+        arena->next = arena->end = NULL;
+    }
+}
+
+/*
+    @description:
+        Releases the arena and everything allocated from it.
+        Do nothing if arena is NULL.
+*/
+void _arena_destroy(struct _arena *arena)
+{
+    if (arena) {
+        /* The arena lives in its own heap, so this takes everything down at once */
+        _sys_handle_t heap = arena->heap;
+
+        _sys_heapdestroy(&heap);
+    }
+}
+
 /* 
     ===================================================
                 Static helper definitions
@@ -935,6 +1081,10 @@ const char *integer_end(const char *first, const char *last, int base)
     const char *end = last;
     const char *it = end - 1;
 
+    /* The scan below starts at the last character, so there has to be one */
+    if (first == last)
+        return first;
+
     for (;;) {
         if (it == first && group_size && _digitvalue(*end, base) != -1)
             end = first;
@@ -1017,4 +1167,26 @@ char *round_numeric(char *s)
     }
 
     return s;
+}
+
+/*
+    @description:
+        Allocates a chunk with at least size usable bytes from the arena's
+        heap and adds it to the arena's list.
+*/
+struct arena_chunk *arena_chunk(struct _arena *arena, size_t size)
+{
+    struct arena_chunk *chunk;
+
+    if (size > (size_t)-1 - sizeof *chunk)
+        return NULL;
+
+    if (!(chunk = (struct arena_chunk*)_sys_heapalloc(arena->heap, sizeof *chunk + size)))
+        return NULL;
+
+    chunk->prev = arena->chunks;
+    chunk->size = size;
+    arena->chunks = chunk;
+
+    return chunk;
 }
\ No newline at end of file
@@ -0,0 +1,17 @@
+#ifndef _CHECK_H
+#define _CHECK_H
+
+#include "stdio.h"
+
+/*
+    Each check program is a plain main that counts failed checks and
+    exits with a nonzero status if there were any (see run.sh).
+*/
+static int check_failures;
+
+#define CHECK(cond) \
+    ((cond) ? (void)0 : (void)(++check_failures, printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond)))
+
+#define CHECK_DONE() (check_failures == 0 ? 0 : 1)
+
+#endif /* _CHECK_H */
\ No newline at end of file
@@ -0,0 +1,134 @@
+#include "check.h"
+#include "stdint.h"
+#include "stdlib.h"
+#include "string.h"
+
+/* Fills a block with a pattern that depends on where each byte is */
+static void fill(unsigned char *p, size_t n, unsigned seed)
+{
+    size_t i;
+
+    for (i = 0; i < n; ++i)
+        p[i] = (unsigned char)(seed + i * 7);
+}
+
+static int intact(const unsigned char *p, size_t n, unsigned seed)
+{
+    size_t i;
+
+    for (i = 0; i < n; ++i) {
+        if (p[i] != (unsigned char)(seed + i * 7))
+            return 0;
+    }
+
+    return 1;
+}
+
+/* Every size class and some large blocks, all in use at once */
+static void check_sizes(void)
+{
+    static unsigned char *blocks[400];
+    size_t i;
+
+    for (i = 0; i < 400; ++i) {
+        size_t size = i < 300 ? i * 61 + 1 : (i - 299) * 20000;
+
+        blocks[i] = (unsigned char*)malloc(size);
+        CHECK(blocks[i] != NULL && (uintptr_t)blocks[i] % 16 == 0);
+        fill(blocks[i], size, (unsigned)i);
+    }
+
+    for (i = 0; i < 400; ++i) {
+        size_t size = i < 300 ? i * 61 + 1 : (i - 299) * 20000;
+
+        CHECK(intact(blocks[i], size, (unsigned)i));
+        free(blocks[i]);
+    }
+}
+
+/* realloc keeps the contents through growing and shrinking, small and large */
+static void check_realloc(void)
+{
+    static const size_t sizes[] = { 1, 24, 100, 5000, 16384, 20000, 300000, 2000000, 70000, 900, 8 };
+    unsigned char *p = NULL;
+    size_t kept = 0, i;
+
+    for (i = 0; i < sizeof sizes / sizeof *sizes; ++i) {
+        size_t keep = kept < sizes[i] ? kept : sizes[i];
+
+        p = (unsigned char*)realloc(p, sizes[i]);
+        CHECK(p != NULL);
+        CHECK(intact(p, keep, 3));
+        fill(p, sizes[i], 3);
+        kept = sizes[i];
+    }
+
+    free(p);
+
+    p = (unsigned char*)calloc(1000, 3);
+    CHECK(p != NULL);
+
+    for (i = 0; i < 3000 && p[i] == 0; ++i)
+        ;
+
+    CHECK(i == 3000);
+    free(p);
+}
+
+/* aligned_alloc and posix_memalign, for small and large blocks */
+static void check_aligned(void)
+{
+    size_t align, size;
+
+    for (align = 16; align <= 65536; align *= 4) {
+        for (size = align; size <= 4 * align; size += align) {
+            void *p = aligned_alloc(align, size);
+            void *q = NULL;
+
+            CHECK(p != NULL && (uintptr_t)p % align == 0);
+            CHECK(posix_memalign(&q, align, size + 1) == 0 && (uintptr_t)q % align == 0);
+            fill((unsigned char*)p, size, 5);
+            fill((unsigned char*)q, size + 1, 6);
+            CHECK(intact((unsigned char*)p, size, 5));
+            free(p);
+            free(q);
+        }
+    }
+
+    {
+        void *q = NULL;
+
+        CHECK(posix_memalign(&q, 24, 10) != 0);
+    }
+}
+
+/* An arena hands out aligned memory and gives it all back at once */
+static void check_arena(void)
+{
+    struct _arena *arena = _arena_create(0);
+    int i;
+
+    CHECK(arena != NULL);
+
+    for (i = 0; i < 1000; ++i) {
+        char *p = (char*)_arena_alloc(arena, (size_t)(i % 50) + 1);
+
+        CHECK(p != NULL && (uintptr_t)p % 16 == 0);
+        memset(p, i, (size_t)(i % 50) + 1);
+    }
+
+    CHECK(_arena_alloc(arena, 1000000) != NULL);
+    _arena_reset(arena);
+    CHECK(_arena_alloc(arena, 64) != NULL);
+    _arena_destroy(arena);
+}
+
+int main(void)
+{
+    check_sizes();
+    check_realloc();
+    check_aligned();
+    check_arena();
+
+    return CHECK_DONE();
+}
\ No newline at end of file
@@ -0,0 +1,102 @@
+#include "check.h"
+#include "stdlib.h"
+#include "string.h"
+
+/* fmemopen reads and writes a fixed block, stopping at its end */
+static void check_fmemopen(void)
+{
+    char block[8], word[16];
+    FILE *fp = fmemopen("alpha beta", 10, "r");
+
+    CHECK(fp != NULL);
+    CHECK(fscanf(fp, "%15s", word) == 1 && strcmp(word, "alpha") == 0);
+    CHECK(ftell(fp) == 5);
+    CHECK(fscanf(fp, "%15s", word) == 1 && strcmp(word, "beta") == 0);
+    CHECK(fgetc(fp) == EOF && feof(fp));
+    fclose(fp);
+
+    fp = fmemopen(block, sizeof block, "w");
+    CHECK(fp != NULL);
+    setvbuf(fp, NULL, _IONBF, 1);
+    CHECK(fwrite("0123456789", 1, 10, fp) < 10);
+    CHECK(memcmp(block, "01234567", 8) == 0);
+    fclose(fp);
+}
+
+/* open_memstream publishes its growing buffer on every flush */
+static void check_memstream(void)
+{
+    char *buf = NULL;
+    size_t size = 0;
+    FILE *fp = open_memstream(&buf, &size);
+    int i;
+
+    CHECK(fp != NULL);
+    fputs("hello", fp);
+    fflush(fp);
+    CHECK(size == 5 && strcmp(buf, "hello") == 0);
+
+    for (i = 0; i < 1000; ++i)
+        fprintf(fp, "%d,", i % 10);
+
+    fclose(fp);
+    CHECK(size == 2005 && buf[2005] == '\0' && strncmp(buf + 5, "0,1,2,", 6) == 0);
+    free(buf);
+}
+
+/* An in-memory tmpfile keeps every API that worked on the file-backed one */
+static void check_tmpfile(void)
+{
+    struct _sys_iovec out[2], in[2];
+    char a[4] = {0}, b[8] = {0}, buf[16] = {0};
+    FILE *fp = tmpfile();
+    size_t i;
+
+    CHECK(fp != NULL);
+    out[0].base = "abc";
+    out[0].len = 3;
+    out[1].base = "defgh";
+    out[1].len = 5;
+    CHECK(_fwritev(fp, out, 2) == 8);
+
+    rewind(fp);
+    in[0].base = a;
+    in[0].len = 3;
+    in[1].base = b;
+    in[1].len = 5;
+    CHECK(_freadv(fp, in, 2) == 8 && strcmp(a, "abc") == 0 && strcmp(b, "defgh") == 0);
+
+    CHECK(_fpwrite("XYZ", 1, 3, 2, fp) == 3);
+    CHECK(_fpread(buf, 1, 8, 0, fp) == 8 && strcmp(buf, "abXYZfgh") == 0);
+    fclose(fp);
+
+    /* Growing past the spill size moves the data to a real file */
+    fp = tmpfile();
+    CHECK(fp != NULL);
+
+    for (i = 0; i < 100000; ++i)
+        fputc('0' + i % 10, fp);
+
+    rewind(fp);
+
+    for (i = 0; i < 100000 && fgetc(fp) == '0' + (int)(i % 10); ++i)
+        ;
+
+    CHECK(i == 100000);
+    fclose(fp);
+
+    fp = tmpfile();
+    CHECK(fp != NULL);
+    CHECK(setvbuf(fp, NULL, _IOLOG, 4096) == 0);
+    CHECK(fputs("record\n", fp) >= 0);
+    fclose(fp);
+}
+
+int main(void)
+{
+    check_fmemopen();
+    check_memstream();
+    check_tmpfile();
+
+    return CHECK_DONE();
+}
\ No newline at end of file
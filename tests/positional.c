@@ -0,0 +1,86 @@
+#include "check.h"
+#include "stdlib.h"
+#include "string.h"
+
+/* _fpread and _fpwrite leave the file position alone and see ordinary writes */
+static void check_pread(const char *name)
+{
+    static char big[100000];
+    char buf[8] = {0};
+    FILE *fp = fopen(name, "wb+");
+    size_t i;
+
+    CHECK(fp != NULL);
+    CHECK(fwrite("AAAAAAAAAA", 1, 10, fp) == 10);
+    CHECK(_fpread(buf, 1, 4, 2, fp) == 4 && memcmp(buf, "AAAA", 4) == 0);
+    CHECK(ftell(fp) == 10);
+
+    /* Output that reaches the file through fseek must not leave the read window stale */
+    fseek(fp, 2, SEEK_SET);
+    fwrite("BBBB", 1, 4, fp);
+    fseek(fp, 0, SEEK_SET);
+    CHECK(_fpread(buf, 1, 4, 2, fp) == 4 && memcmp(buf, "BBBB", 4) == 0);
+
+    CHECK(_fpwrite("CC", 1, 2, 8, fp) == 2);
+    CHECK(ftell(fp) == 0);
+    CHECK(fread(buf, 1, 8, fp) == 8);
+    CHECK(_fpread(buf, 1, 4, 6, fp) == 4 && memcmp(buf, "AACC", 4) == 0);
+
+    /* Big reads skip the window */
+    for (i = 0; i < sizeof big; ++i)
+        big[i] = (char)(i % 251);
+
+    CHECK(_fpwrite(big, 1, sizeof big, 10, fp) == sizeof big);
+    memset(big, 0, sizeof big);
+    CHECK(_fpread(big, 1, sizeof big, 10, fp) == sizeof big);
+
+    for (i = 0; i < sizeof big && big[i] == (char)(i % 251); ++i)
+        ;
+
+    CHECK(i == sizeof big);
+    CHECK(_fpread(buf, 1, 4, 10 + sizeof big, fp) == 0);
+    fclose(fp);
+}
+
+/* _ffill refills many streams at once, and a stream listed twice is read once */
+static void check_ffill(const char *name)
+{
+    FILE *fp = fopen(name, "w");
+    FILE *streams[3];
+    int i, v = -1;
+
+    CHECK(fp != NULL);
+
+    for (i = 0; i < 100000; ++i)
+        fprintf(fp, "%d\n", i);
+
+    fclose(fp);
+
+    streams[0] = fopen(name, "r");
+    streams[1] = fopen(name, "r");
+    streams[2] = streams[0];
+    CHECK(streams[0] != NULL && streams[1] != NULL);
+    CHECK(_ffill(streams, 3) >= 2);
+
+    for (i = 0; i < 100000; ++i) {
+        if (fscanf(streams[0], "%d", &v) != 1 || v != i)
+            break;
+    }
+
+    CHECK(i == 100000);
+    CHECK(fscanf(streams[1], "%d", &v) == 1 && v == 0);
+    fclose(streams[0]);
+    fclose(streams[1]);
+}
+
+int main(void)
+{
+    char name[L_tmpnam];
+
+    CHECK(tmpnam(name) != NULL);
+    check_pread(name);
+    check_ffill(name);
+    remove(name);
+
+    return CHECK_DONE();
+}
\ No newline at end of file
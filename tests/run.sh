@@ -0,0 +1,42 @@
+#!/bin/sh
+# Builds the library for Linux on i386 (the ABI the rest of the library
+# assumes) and runs every check program in this directory. It needs a gcc
+# that can target -m32. CC, CFLAGS, LDLIBS and OUT override the defaults.
+
+root=$(cd "$(dirname "$0")/.." && pwd)
+out=${OUT:-${TMPDIR:-/tmp}/c-standard-library-tests}
+CC=${CC:-gcc}
+LDLIBS=${LDLIBS:--lgcc}
+flags="-m32 -std=c99 -O2 -nostdinc -fno-stack-protector -fno-pie -fno-tree-loop-distribute-patterns -w"
+flags="$flags -I$root/includes/std -I$root/includes/internal $CFLAGS"
+failed=0
+
+mkdir -p "$out/lib" || exit 1
+
+for src in "$root"/src/std/*.c "$root"/src/internal/*.c; do
+    obj="$out/lib/$(basename "$src" .c).o"
+
+    case "$src" in
+    */math.c)
+        # math.h doesn't declare everything math.c uses yet, so it leans on the compiler's builtins
+        $CC $flags -Disgreaterequal=__builtin_isgreaterequal -Dislessequal=__builtin_islessequal -c "$src" -o "$obj" || exit 1 ;;
+    *)
+        $CC $flags -fno-builtin -c "$src" -o "$obj" || exit 1 ;;
+    esac
+done
+
+for test in "$root"/tests/*.c; do
+    name=$(basename "$test" .c)
+
+    if $CC $flags -fno-builtin -c "$test" -o "$out/$name.o" &&
+       $CC -m32 -nostdlib -static -no-pie "$out"/lib/*.o "$out/$name.o" $LDLIBS -o "$out/$name" &&
+       "$out/$name"
+    then
+        echo "PASS $name"
+    else
+        echo "FAIL $name"
+        failed=1
+    fi
+done
+
+exit $failed
@@ -0,0 +1,110 @@
+#include "check.h"
+#include "stdlib.h"
+#include "string.h"
+
+/* Bulk fread/fwrite around buffer boundaries, with ftell tracked along the way */
+static void check_bulk(const char *name)
+{
+    static char out[20000], in[20000];
+    FILE *fp = fopen(name, "wb");
+    size_t i;
+
+    for (i = 0; i < sizeof out; ++i)
+        out[i] = (char)('a' + i % 26);
+
+    CHECK(fp != NULL);
+    setvbuf(fp, NULL, _IOFBF, 512);
+    CHECK(fwrite(out, 1, 100, fp) == 100);
+    CHECK(ftell(fp) == 100);
+    CHECK(fwrite(out + 100, 1, sizeof out - 100, fp) == sizeof out - 100);
+    CHECK(ftell(fp) == (long)sizeof out);
+    fclose(fp);
+
+    fp = fopen(name, "rb");
+    CHECK(fp != NULL);
+    setvbuf(fp, NULL, _IOFBF, 512);
+    CHECK(fread(in, 1, 7, fp) == 7);
+    CHECK(ftell(fp) == 7);
+    CHECK(fread(in + 7, 1, sizeof in, fp) == sizeof in - 7);
+    CHECK(feof(fp));
+    CHECK(memcmp(in, out, sizeof in) == 0);
+
+    CHECK(fseek(fp, 12345, SEEK_SET) == 0);
+    CHECK(ftell(fp) == 12345);
+    CHECK(fgetc(fp) == out[12345]);
+    CHECK(ftell(fp) == 12346);
+    fclose(fp);
+}
+
+/* putc_unlocked may fill the buffer without flushing, and fputc must cope */
+static void check_unlocked(const char *name)
+{
+    FILE *fp = fopen(name, "wb");
+    int i;
+
+    CHECK(fp != NULL);
+    setvbuf(fp, NULL, _IOFBF, 64);
+
+    for (i = 0; i < 200; ++i) {
+        if (i % 3)
+            putc_unlocked('a' + i % 26, fp);
+        else
+            fputc('a' + i % 26, fp);
+    }
+
+    fclose(fp);
+
+    fp = fopen(name, "rb");
+    CHECK(fp != NULL);
+
+    for (i = 0; i < 200 && fgetc(fp) == 'a' + i % 26; ++i)
+        ;
+
+    CHECK(i == 200);
+    CHECK(fgetc(fp) == EOF);
+    fclose(fp);
+}
+
+/* getline and getdelim, including lines longer than the stream buffer */
+static void check_getline(const char *name)
+{
+    FILE *fp = fopen(name, "wb");
+    char *line = NULL;
+    size_t size = 0;
+    int i;
+
+    CHECK(fp != NULL);
+    fputs("first\n\nthird line\n", fp);
+
+    for (i = 0; i < 3000; ++i)
+        fputc('x', fp);
+
+    fputs("\nlast", fp);
+    fclose(fp);
+
+    fp = fopen(name, "rb");
+    CHECK(fp != NULL);
+    setvbuf(fp, NULL, _IOFBF, 256);
+    CHECK(getline(&line, &size, fp) == 6 && strcmp(line, "first\n") == 0);
+    CHECK(getline(&line, &size, fp) == 1 && strcmp(line, "\n") == 0);
+    CHECK(getdelim(&line, &size, ' ', fp) == 6 && strcmp(line, "third ") == 0);
+    CHECK(getline(&line, &size, fp) == 5 && strcmp(line, "line\n") == 0);
+    CHECK(getline(&line, &size, fp) == 3001 && line[2999] == 'x' && line[3000] == '\n');
+    CHECK(getline(&line, &size, fp) == 4 && strcmp(line, "last") == 0);
+    CHECK(getline(&line, &size, fp) == -1 && feof(fp));
+    free(line);
+    fclose(fp);
+}
+
+int main(void)
+{
+    char name[L_tmpnam];
+
+    CHECK(tmpnam(name) != NULL);
+    check_bulk(name);
+    check_unlocked(name);
+    check_getline(name);
+    remove(name);
+
+    return CHECK_DONE();
+}
\ No newline at end of file